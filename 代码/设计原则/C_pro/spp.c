@@ -1,109 +1,845 @@
+// 编译: gcc -std=c11 -O2 -pthread spp.c -o spp
+// 用法: ./spp [-j 线程数] [--stream] [--utf8] [--validate] [输入文件] [输出文件]
+//   -j 0 表示使用全部在线 CPU；输入为 "-" 时读标准输入。
+//   管道、套接字等非普通文件和 --stream 都走流式路径，内存占用固定为一个读缓冲区。
+//   --utf8 按 UTF-8 统计（字符数为码点数，识别 Unicode 空白如 U+3000），
+//   --validate 同时校验 UTF-8 合法性（隐含 --utf8），不合法时返回 2。
+//       ./spp --batch 目录或清单文件 [输出文件]
+//   批量统计：目录递归收集普通文件，清单文件每行一个路径（"-" 为标准输入）。
+//   输出汇总报告和逐文件明细；读取走 io_uring，不可用时退回 pread 线程池（-j 指定线程数）。
+//   --cache 缓存文件：记住每个文件统计到的位置，只追加的文件下次只扫新增部分；
+//   文件被截断或改写时整体重算。流式输入和 --validate 不使用缓存。
+
+#define _DEFAULT_SOURCE // strdup / madvise
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 批量模式的 io_uring 读流水线：只用内核头文件和原始系统调用，不依赖 liburing
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define SPP_HAVE_IO_URING 1
+#endif
+#endif
 
 // ==================== 文件操作职责 ====================
 
 // 文件读取器 - 只负责文件的读取操作
+// 普通文件直接只读映射（content 指向映射区，不以 NUL 结尾，长度见 length），
+// 管道/特殊文件等不能映射的输入退回到读入堆内存。
 typedef struct
 {
     char *content;
     size_t length;
+    int mapped; // 1: content 是 mmap 映射，需 munmap 释放
 } FileReader;
 
 FileReader *create_file_reader()
 {
-    return (FileReader *)malloc(sizeof(FileReader));
+    FileReader *reader = (FileReader *)malloc(sizeof(FileReader));
+    if (reader)
+    {
+        reader->content = NULL;
+        reader->length = 0;
+        reader->mapped = 0;
+    }
+    return reader;
+}
+
+#ifndef _WIN32
+// 普通且非空的文件：只读映射并提示内核顺序预读。失败返回 0，由调用方走拷贝路径。
+// 描述符由调用方打开和关闭，FIFO 之类只能打开一次的输入不会被重复打开。
+static int map_file(FileReader *reader, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return 0;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    reader->content = (char *)map;
+    reader->length = (size_t)st.st_size;
+    reader->mapped = 1;
+    return 1;
+}
+#endif
+
+// 不能映射时的拷贝路径：按块读到堆内存里，不依赖 fseek/ftell，管道也能读。
+static int copy_file(FileReader *reader, FILE *file)
+{
+    size_t capacity = 64 * 1024, length = 0;
+    char *content = (char *)malloc(capacity);
+    while (content)
+    {
+        length += fread(content + length, 1, capacity - length, file);
+        if (length < capacity)
+            break; // EOF 或读错误
+        char *bigger = (char *)realloc(content, capacity * 2);
+        if (!bigger)
+        {
+            free(content);
+            content = NULL;
+            break;
+        }
+        content = bigger;
+        capacity *= 2;
+    }
+    int ok = content && !ferror(file);
+    if (!ok)
+    {
+        free(content);
+        return 0;
+    }
+
+    reader->content = content;
+    reader->length = length;
+    reader->mapped = 0;
+    return 1;
 }
 
 int read_file(FileReader *reader, const char *filename)
 {
-    FILE *file = fopen(filename, "r");
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "rb");
+    if (!file && fd >= 0)
+        close(fd);
+#else
+    FILE *file = fopen(filename, "rb");
+#endif
     if (!file)
     {
         printf("无法打开文件: %s\n", filename);
         return 0;
     }
+#ifndef _WIN32
+    int ok = map_file(reader, fd) || copy_file(reader, file); // 映射建立后描述符即可关闭
+#else
+    int ok = copy_file(reader, file);
+#endif
+    fclose(file);
+    return ok;
+}
 
-    // 获取文件大小
-    fseek(file, 0, SEEK_END);
-    reader->length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    // 分配内存并读取内容
-    reader->content = (char *)malloc(reader->length + 1);
-    if (!reader->content)
+void destroy_file_reader(FileReader *reader)
+{
+    if (reader)
     {
-        fclose(file);
-        return 0;
+#ifndef _WIN32
+        if (reader->mapped)
+            munmap(reader->content, reader->length);
+        else
+#endif
+            free(reader->content);
+        free(reader);
     }
+}
 
-    fread(reader->content, 1, reader->length, file);
-    reader->content[reader->length] = '\0';
+// 流式读取器 - 只负责用一块固定大小、反复复用的缓冲区逐块读取输入，
+// 不要求输入可定位，标准输入、管道、套接字都能读
+#define SPP_STREAM_BUFFER (256 * 1024)
 
-    fclose(file);
-    return 1;
+typedef struct
+{
+    FILE *file;
+    int owned; // 0: 标准输入，不由读取器关闭
+    int error;
+    char *buffer;
+    size_t capacity;
+} StreamReader;
+
+// filename 为 "-" 时读标准输入
+StreamReader *create_stream_reader(const char *filename)
+{
+    int is_stdin = strcmp(filename, "-") == 0;
+    FILE *file = is_stdin ? stdin : fopen(filename, "rb");
+    if (!file)
+    {
+        printf("无法打开文件: %s\n", filename);
+        return NULL;
+    }
+    StreamReader *reader = (StreamReader *)malloc(sizeof(StreamReader));
+    char *buffer = (char *)malloc(SPP_STREAM_BUFFER);
+    if (!reader || !buffer)
+    {
+        free(reader);
+        free(buffer);
+        if (!is_stdin)
+            fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+    reader->owned = !is_stdin;
+    reader->error = 0;
+    reader->buffer = buffer;
+    reader->capacity = SPP_STREAM_BUFFER;
+    return reader;
 }
 
-void destroy_file_reader(FileReader *reader)
+// 读下一块到 reader->buffer，返回本次字节数；返回 0 表示结束，出错时 error 置 1。
+// POSIX 下直接 read()，有多少拿多少，不经过 stdio 的二次缓冲。
+size_t stream_read(StreamReader *reader)
+{
+#ifndef _WIN32
+    for (;;)
+    {
+        ssize_t n = read(fileno(reader->file), reader->buffer, reader->capacity);
+        if (n >= 0)
+            return (size_t)n;
+        if (errno != EINTR)
+        {
+            reader->error = 1;
+            return 0;
+        }
+    }
+#else
+    size_t n = fread(reader->buffer, 1, reader->capacity, reader->file);
+    if (n == 0 && ferror(reader->file))
+        reader->error = 1;
+    return n;
+#endif
+}
+
+void destroy_stream_reader(StreamReader *reader)
 {
     if (reader)
     {
-        free(reader->content);
+        if (reader->owned)
+            fclose(reader->file);
+        free(reader->buffer);
         free(reader);
     }
 }
 
 // ==================== 文本处理职责 ====================
 
+// UTF-8 校验器状态。标量实现用 need/lo/hi（还差几个续字节、下一个字节的合法范围）；
+// AVX2 实现按 32 字节一块处理，不足一块的尾巴留在 carry 里，prev 是上一块。
+typedef struct
+{
+    int error;
+    int need;
+    unsigned char lo, hi;
+    size_t carried;
+    unsigned char carry[32];
+    unsigned char prev[32];
+} Utf8Validator;
+
 // 文本处理器 - 只负责文本内容的处理
+// 流式喂入期间 line_count 只是已见到的换行符个数，finish 之后才是行数
 typedef struct
 {
-    int word_count;
-    int char_count;
-    int line_count;
+    size_t word_count;
+    size_t char_count; // 字节模式为字节数，UTF-8 模式为码点数
+    size_t line_count;
+    int in_word; // 上一次 feed 结束时是否停在单词中间
+
+    // UTF-8 模式（配置项，reset 不清除）
+    int utf8;
+    int validate;
+    // 跨 feed 未完成的候选空白序列（见 Utf8Counts）和校验器
+    uint32_t pending_cp;
+    int pending_need;
+    Utf8Validator validator;
 } TextProcessor;
 
+// 默认按字节统计
 TextProcessor *create_text_processor()
 {
-    return (TextProcessor *)malloc(sizeof(TextProcessor));
+    return (TextProcessor *)calloc(1, sizeof(TextProcessor));
 }
 
-void process_text(TextProcessor *processor, const char *text)
+// validate 隐含 utf8
+void text_processor_set_utf8(TextProcessor *processor, int utf8, int validate)
 {
-    processor->word_count = 0;
-    processor->char_count = 0;
-    processor->line_count = 0;
+    processor->utf8 = utf8 || validate;
+    processor->validate = validate;
+}
 
-    if (!text)
-        return;
+// ---------- 计数内核 ----------
+
+// 一段文本的部分计数。in_word 既是输入（段前最后一个字节是否在单词中）
+// 也是输出（段尾状态），因此可以把长文本分段依次喂给内核。
+typedef struct
+{
+    size_t words;
+    size_t newlines;
+    int in_word;
+} TextCounts;
 
-    int in_word = 0;
-    const char *ptr = text;
+// 空白分类表：与 C locale 的 isspace 相同（' ', \t, \n, \v, \f, \r），
+// 0x80 以上的字节不是空白
+static const unsigned char space_table[256] = {
+    ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1, [' '] = 1};
 
-    while (*ptr)
+static void count_scalar(const unsigned char *p, size_t n, TextCounts *c)
+{
+    size_t words = 0, newlines = 0;
+    int in_word = c->in_word;
+    for (size_t i = 0; i < n; ++i)
     {
-        processor->char_count++;
+        newlines += p[i] == '\n';
+        if (space_table[p[i]])
+            in_word = 0;
+        else if (!in_word)
+        {
+            ++words;
+            in_word = 1;
+        }
+    }
+    c->words += words;
+    c->newlines += newlines;
+    c->in_word = in_word;
+}
+
+// 64 字节一块：ws/nl 为逐字节的空白/换行位图（bit i 对应第 i 个字节）。
+// 单词起点 = 非空白且前一个字节是空白；块首字节的“前一个字节”来自上一块的状态。
+static inline void count_masks(uint64_t ws, uint64_t nl, TextCounts *c)
+{
+    uint64_t prev_ws = (ws << 1) | (uint64_t)!c->in_word;
+    c->words += (size_t)__builtin_popcountll(~ws & prev_ws);
+    c->newlines += (size_t)__builtin_popcountll(nl);
+    c->in_word = !(ws >> 63);
+}
 
-        if (*ptr == '\n')
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SPP_HAVE_X86_SIMD 1
+
+// SSE2 没有字节查表指令：空白 = (c == ' ') 或 (c - 9) 无符号 <= 4
+__attribute__((target("sse2"))) static void count_sse2(const unsigned char *p, size_t n, TextCounts *c)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        uint64_t ws = 0, nl = 0;
+        for (int k = 0; k < 4; ++k)
         {
-            processor->line_count++;
+            __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i + 16 * k));
+            __m128i t = _mm_sub_epi8(v, tab);
+            __m128i is_ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(_mm_min_epu8(t, four), t));
+            ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_ws) << (16 * k);
+            nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * k);
         }
+        count_masks(ws, nl, c);
+    }
+    count_scalar(p + i, n - i, c);
+}
+
+// AVX2：按低 4 位查表（pshufb），表中放“低 4 位为该值的那个空白字符”，
+// 查出来等于自身即为空白；最高位为 1 的字节查表结果为 0，不会误判。
+__attribute__((target("avx2"))) static void count_avx2(const unsigned char *p, size_t n, TextCounts *c)
+{
+    const __m256i lut = _mm256_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0,
+                                         ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(const void *)(p + i + 32));
+        __m256i ws_lo = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, lo), lo);
+        __m256i ws_hi = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, hi), hi);
+        uint64_t ws = (uint32_t)_mm256_movemask_epi8(ws_lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(ws_hi) << 32;
+        uint64_t nl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+        count_masks(ws, nl, c);
+    }
+    count_scalar(p + i, n - i, c);
+}
+#endif
+
+typedef void (*count_fn_t)(const unsigned char *, size_t, TextCounts *);
+
+static count_fn_t select_count_kernel(void)
+{
+    static count_fn_t kernel;
+    if (kernel)
+        return kernel;
+    kernel = count_scalar;
+#ifdef SPP_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = count_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        kernel = count_sse2;
+#endif
+    return kernel;
+}
+
+// ---------- UTF-8 计数 ----------
+
+// 码点数 = 字节数 - 续字节（10xxxxxx）数。
+// 多字节空白只有下面这些，其首字节只可能是 C2、E1、E2、E3；其余非 ASCII 字节一律不是空白。
+static int unicode_space(uint32_t cp)
+{
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 ||
+           cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+// 在 TextCounts 基础上多记续字节数，以及一个未完成的候选空白序列：
+// 遇到 C2/E1/E2/E3 先挂起（cp 为已解出的位，need 为还差的续字节数），
+// 序列完整后按码点判定空白；被非续字节截断则按一个非空白字符处理。
+typedef struct
+{
+    TextCounts text;
+    size_t continuations;
+    uint32_t cp;
+    int need;
+} Utf8Counts;
+
+static inline void utf8_char(int space, TextCounts *c)
+{
+    if (space)
+        c->in_word = 0;
+    else if (!c->in_word)
+    {
+        ++c->words;
+        c->in_word = 1;
+    }
+}
 
-        if (isspace(*ptr))
+// 状态都放在局部变量里：p 是字节指针，直接写 *c 会被当作可能别名而每字节重新读写
+static void count_utf8_scalar(const unsigned char *p, size_t n, Utf8Counts *c)
+{
+    TextCounts t = c->text;
+    size_t continuations = 0;
+    uint32_t cp = c->cp;
+    int need = c->need;
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char b = p[i];
+        int cont = (b & 0xC0) == 0x80;
+        t.newlines += b == '\n';
+        continuations += cont;
+        if (need)
         {
-            in_word = 0;
+            if (cont)
+            {
+                cp = cp << 6 | (b & 0x3F);
+                if (--need == 0)
+                    utf8_char(unicode_space(cp), &t);
+                continue;
+            }
+            need = 0;
+            utf8_char(0, &t);
         }
-        else if (!in_word)
+        if (b == 0xC2)
+            cp = 2, need = 1;
+        else if (b >= 0xE1 && b <= 0xE3)
+            cp = b & 0x0F, need = 2;
+        else
         {
-            processor->word_count++;
-            in_word = 1;
+            int word = !space_table[b]; // 无分支的 utf8_char
+            t.words += (size_t)(word & !t.in_word);
+            t.in_word = word;
+        }
+    }
+    c->text = t;
+    c->continuations += continuations;
+    c->cp = cp;
+    c->need = need;
+}
+
+// 文本结束（或分块结束）时，挂起的序列按非空白字符收尾
+static void utf8_settle(Utf8Counts *c)
+{
+    if (c->need)
+    {
+        c->need = 0;
+        utf8_char(0, &c->text);
+    }
+}
+
+#ifdef SPP_HAVE_X86_SIMD
+// 32 个位置上是否恰好以一个多字节空白开头（需要能读到 q[33]）。
+// 返回 3 字节空白（E1/E2/E3 开头）的首字节位置，2 字节空白（C2 开头）写到 *two。
+__attribute__((target("avx2"))) static inline __m256i utf8_space_leads(const unsigned char *q, __m256i *two)
+{
+#define SPP_EQ(x, b) _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)(b)))
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)q);
+    __m256i n1 = _mm256_loadu_si256((const __m256i *)(const void *)(q + 1));
+    __m256i n2 = _mm256_loadu_si256((const __m256i *)(const void *)(q + 2));
+    __m256i t = _mm256_sub_epi8(n2, _mm256_set1_epi8((char)0x80));
+    __m256i n2_80_8a = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(0x0A)), t);
+    __m256i e1 = _mm256_and_si256(SPP_EQ(v, 0xE1), _mm256_and_si256(SPP_EQ(n1, 0x9A), SPP_EQ(n2, 0x80)));
+    __m256i e2_80 = _mm256_and_si256(
+        SPP_EQ(n1, 0x80), _mm256_or_si256(_mm256_or_si256(n2_80_8a, SPP_EQ(n2, 0xA8)),
+                                          _mm256_or_si256(SPP_EQ(n2, 0xA9), SPP_EQ(n2, 0xAF))));
+    __m256i e2_81 = _mm256_and_si256(SPP_EQ(n1, 0x81), SPP_EQ(n2, 0x9F));
+    __m256i e2 = _mm256_and_si256(SPP_EQ(v, 0xE2), _mm256_or_si256(e2_80, e2_81));
+    __m256i e3 = _mm256_and_si256(SPP_EQ(v, 0xE3), _mm256_and_si256(SPP_EQ(n1, 0x80), SPP_EQ(n2, 0x80)));
+    *two = _mm256_and_si256(SPP_EQ(v, 0xC2), _mm256_or_si256(SPP_EQ(n1, 0x85), SPP_EQ(n1, 0xA0)));
+#undef SPP_EQ
+    return _mm256_or_si256(e1, _mm256_or_si256(e2, e3));
+}
+
+// 非 ASCII 字节里只有完整匹配上的多字节空白才算空白，且匹配靠向后看 2 字节就能确定，
+// 所以整块都能用位图处理：把匹配到的序列的每个字节并进空白位图，伸出块尾的部分（spill）
+// 带到下一块。续字节用有符号比较数（< -64 即 0x80..0xBF）。
+// 只有带着挂起序列进来的块（上次 feed 在序列中间结束）交给标量。
+__attribute__((target("avx2"))) static void count_utf8_avx2(const unsigned char *p, size_t n, Utf8Counts *c)
+{
+    const __m256i lut = _mm256_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0,
+                                         ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i lead_min = _mm256_set1_epi8(-64);
+    uint64_t spill = 0;
+    size_t i = 0;
+    for (; i + 66 <= n; i += 64)
+    {
+        if (c->need)
+        {
+            count_utf8_scalar(p + i, 64, c);
+            continue;
+        }
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(const void *)(p + i + 32));
+        __m256i two_lo, two_hi;
+        __m256i three_lo = utf8_space_leads(p + i, &two_lo);
+        __m256i three_hi = utf8_space_leads(p + i + 32, &two_hi);
+        uint64_t m2 = (uint32_t)_mm256_movemask_epi8(two_lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(two_hi) << 32;
+        uint64_t m3 =
+            (uint32_t)_mm256_movemask_epi8(three_lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(three_hi) << 32;
+        __m256i ws_lo = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, lo), lo);
+        __m256i ws_hi = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, hi), hi);
+        uint64_t ws = (uint32_t)_mm256_movemask_epi8(ws_lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(ws_hi) << 32;
+        uint64_t nl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+        uint64_t cont = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(lead_min, lo)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(lead_min, hi)) << 32;
+        ws |= m2 | m2 << 1 | m3 | m3 << 1 | m3 << 2 | spill;
+        spill = m2 >> 63 | m3 >> 63 | m3 >> 62;
+        count_masks(ws, nl, &c->text);
+        c->continuations += (size_t)__builtin_popcountll(cont);
+    }
+    // 伸进尾部的续字节已按空白计入，跳过它们，标量从下一个字符开始
+    size_t k = (size_t)__builtin_popcountll(spill);
+    c->continuations += k;
+    i += k;
+    count_utf8_scalar(p + i, n - i, c);
+}
+#endif
+
+typedef void (*utf8_count_fn_t)(const unsigned char *, size_t, Utf8Counts *);
+
+static utf8_count_fn_t select_utf8_kernel(void)
+{
+    static utf8_count_fn_t kernel;
+    if (kernel)
+        return kernel;
+    kernel = count_utf8_scalar;
+#ifdef SPP_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = count_utf8_avx2;
+#endif
+    return kernel;
+}
+
+// 分块的第一个字符是否为空白
+static int utf8_first_space(const unsigned char *p, size_t n)
+{
+    Utf8Counts c = {{0, 0, 0}, 0, 0, 0};
+    for (size_t i = 0; i < n; ++i)
+    {
+        count_utf8_scalar(p + i, 1, &c);
+        if (!c.need)
+            return c.text.words == 0;
+    }
+    return 0;
+}
+
+// ---------- UTF-8 校验 ----------
+
+// 标量 DFA，纯 ASCII 的 8 字节直接跳过。出错后不再继续看。
+static void validate_utf8_scalar(Utf8Validator *v, const unsigned char *p, size_t n)
+{
+    int need = v->need, error = v->error;
+    unsigned char lo = v->lo, hi = v->hi;
+    size_t i = 0;
+    while (i < n && !error)
+    {
+        if (!need)
+        {
+            uint64_t w;
+            while (i + 8 <= n && (memcpy(&w, p + i, 8), !(w & 0x8080808080808080ull)))
+                i += 8;
+            if (i == n)
+                break;
+        }
+        unsigned char b = p[i++];
+        if (need)
+        {
+            error = b < lo || b > hi;
+            --need;
+            lo = 0x80, hi = 0xBF;
+            continue;
+        }
+        if (b < 0x80)
+            continue;
+        lo = 0x80, hi = 0xBF;
+        if (b >= 0xC2 && b <= 0xDF)
+            need = 1;
+        else if (b >= 0xE0 && b <= 0xEF)
+        {
+            need = 2;
+            if (b == 0xE0)
+                lo = 0xA0; // 过长编码
+            else if (b == 0xED)
+                hi = 0x9F; // 代理区 D800..DFFF
+        }
+        else if (b >= 0xF0 && b <= 0xF4)
+        {
+            need = 3;
+            if (b == 0xF0)
+                lo = 0x90;
+            else if (b == 0xF4)
+                hi = 0x8F; // 不超过 U+10FFFF
+        }
+        else
+            error = 1;
+    }
+    v->need = need, v->error = error;
+    v->lo = lo, v->hi = hi;
+}
+
+#ifdef SPP_HAVE_X86_SIMD
+// AVX2 查表校验（Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"）：
+// 用前一字节的高/低 4 位和当前字节的高 4 位各查一张表，三者相与得到该字节对的错误类别；
+// 第 3、4 字节是否必须为续字节由前 2、3 个字节是否为 3/4 字节首字节决定。
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// 当前块整体右移 n 字节、空出的位置用上一块末尾补上（跨 128 位 lane）
+#define UTF8_PREV(cur, prev, n) _mm256_alignr_epi8(cur, _mm256_permute2x128_si256(prev, cur, 0x21), 16 - (n))
+
+__attribute__((target("avx2"))) static inline __m256i utf8_nibble(__m256i v, __m256i table, int high)
+{
+    __m256i nibble = high ? _mm256_srli_epi16(v, 4) : v;
+    return _mm256_shuffle_epi8(table, _mm256_and_si256(nibble, _mm256_set1_epi8(0x0F)));
+}
+
+__attribute__((target("avx2"))) static void validate_utf8_avx2(Utf8Validator *v, const unsigned char *p, size_t n)
+{
+    const __m256i byte_1_high = _mm256_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2, UTF8_TOO_SHORT, UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2, UTF8_TOO_SHORT, UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+#define UTF8_LOW_TABLE                                                                                        \
+    (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),                                 \
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2), (char)UTF8_CARRY, (char)UTF8_CARRY,                             \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE), (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),       \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),                          \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                           \
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000)
+    const __m256i byte_1_low = _mm256_setr_epi8(UTF8_LOW_TABLE, UTF8_LOW_TABLE);
+#undef UTF8_LOW_TABLE
+#define UTF8_CONT_TABLE                                                                                       \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,           \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT,                                                                       \
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 |    \
+               UTF8_OVERLONG_4),                                                                              \
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),          \
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),           \
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),           \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+    const __m256i byte_2_high = _mm256_setr_epi8(UTF8_CONT_TABLE, UTF8_CONT_TABLE);
+#undef UTF8_CONT_TABLE
+    // 块末尾还差续字节的位置：最后 3 个字节分别不能是 4、3、2 字节首字节
+    const __m256i max_value = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(const void *)v->prev);
+    __m256i error = _mm256_setzero_si256();
+    size_t i = 0;
+    for (;;)
+    {
+        __m256i input;
+        if (v->carried)
+        {
+            // 先把上次剩下的尾巴凑满一块
+            size_t take = 32 - v->carried < n ? 32 - v->carried : n;
+            memcpy(v->carry + v->carried, p, take);
+            v->carried += take;
+            i = take;
+            if (v->carried < 32)
+                break;
+            v->carried = 0;
+            input = _mm256_loadu_si256((const __m256i *)(const void *)v->carry);
+        }
+        else if (i + 32 <= n)
+        {
+            input = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+            i += 32;
+        }
+        else
+        {
+            memcpy(v->carry, p + i, n - i);
+            v->carried = n - i;
+            break;
+        }
+
+        if (!_mm256_movemask_epi8(input))
+        {
+            // 纯 ASCII：只需确认上一块末尾没有未完成的序列
+            error = _mm256_or_si256(error, _mm256_subs_epu8(prev, max_value));
+        }
+        else
+        {
+            __m256i prev1 = UTF8_PREV(input, prev, 1);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(utf8_nibble(prev1, byte_1_high, 1), utf8_nibble(prev1, byte_1_low, 0)),
+                utf8_nibble(input, byte_2_high, 1));
+            __m256i third = _mm256_subs_epu8(UTF8_PREV(input, prev, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+            __m256i fourth = _mm256_subs_epu8(UTF8_PREV(input, prev, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+            __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+            error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
         }
+        prev = input;
+    }
+    _mm256_storeu_si256((__m256i *)(void *)v->prev, prev);
+    if (!_mm256_testz_si256(error, error))
+        v->error = 1;
+}
+#undef UTF8_PREV
+#endif
+
+typedef void (*validate_fn_t)(Utf8Validator *, const unsigned char *, size_t);
+
+static validate_fn_t select_validate_kernel(void)
+{
+    static validate_fn_t kernel;
+    if (kernel)
+        return kernel;
+    kernel = validate_utf8_scalar;
+#ifdef SPP_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = validate_utf8_avx2;
+#endif
+    return kernel;
+}
+
+// 输入结束：补一块 ASCII 0，还没收尾的序列会因此报错
+static void validate_utf8_finish(Utf8Validator *v)
+{
+    static const unsigned char zeros[32];
+    select_validate_kernel()(v, zeros, sizeof zeros);
+}
+
+// ---------- 流式接口 ----------
+
+void text_processor_reset(TextProcessor *processor)
+{
+    processor->word_count = 0;
+    processor->char_count = 0;
+    processor->line_count = 0;
+    processor->in_word = 0;
+    processor->pending_cp = 0;
+    processor->pending_need = 0;
+    memset(&processor->validator, 0, sizeof processor->validator);
+}
+
+// UTF-8 模式按片计数和校验，校验读到的数据还在缓存里
+#define SPP_UTF8_SLICE (64 * 1024)
+
+static void text_processor_feed_utf8(TextProcessor *processor, const unsigned char *p, size_t len)
+{
+    utf8_count_fn_t count = select_utf8_kernel();
+    Utf8Counts counts = {{0, 0, processor->in_word}, 0, processor->pending_cp, processor->pending_need};
+    for (size_t off = 0; off < len; off += SPP_UTF8_SLICE)
+    {
+        size_t n = len - off < SPP_UTF8_SLICE ? len - off : SPP_UTF8_SLICE;
+        count(p + off, n, &counts);
+        if (processor->validate)
+            select_validate_kernel()(&processor->validator, p + off, n);
+    }
+    processor->word_count += counts.text.words;
+    processor->char_count += len - counts.continuations;
+    processor->line_count += counts.text.newlines;
+    processor->in_word = counts.text.in_word;
+    processor->pending_cp = counts.cp;
+    processor->pending_need = counts.need;
+}
 
-        ptr++;
+// 喂入一段文本，可以反复调用；跨调用切开的单词（UTF-8 模式下还有多字节字符）只计一次
+void text_processor_feed(TextProcessor *processor, const char *buf, size_t len)
+{
+    if (!buf || len == 0)
+        return;
+    if (processor->utf8)
+    {
+        text_processor_feed_utf8(processor, (const unsigned char *)buf, len);
+        return;
     }
+    TextCounts counts = {0, 0, processor->in_word};
+    select_count_kernel()((const unsigned char *)buf, len, &counts);
+    processor->word_count += counts.words;
+    processor->char_count += len;
+    processor->line_count += counts.newlines;
+    processor->in_word = counts.in_word;
+}
+
+// 收尾挂起的 UTF-8 序列并结束校验，但不补末行（分块计数时每块各自调用）
+static void text_processor_settle(TextProcessor *processor)
+{
+    if (!processor->utf8)
+        return;
+    Utf8Counts counts = {{0, 0, processor->in_word}, 0, processor->pending_cp, processor->pending_need};
+    utf8_settle(&counts);
+    processor->word_count += counts.text.words;
+    processor->in_word = counts.text.in_word;
+    processor->pending_need = 0;
+    if (processor->validate)
+        validate_utf8_finish(&processor->validator);
+}
 
+void text_processor_finish(TextProcessor *processor)
+{
+    text_processor_settle(processor);
     // 如果文本不以换行符结束，也要计为一行
     if (processor->char_count > 0)
     {
@@ -111,12 +847,166 @@ void process_text(TextProcessor *processor, const char *text)
     }
 }
 
+// 开启校验时，输入是否为合法 UTF-8（finish 之后有效）
+int text_processor_valid(const TextProcessor *processor)
+{
+    return !processor->validate || !processor->validator.error;
+}
+
+// text 不要求以 NUL 结尾（可以直接是映射区），长度由 length 给出
+void process_text(TextProcessor *processor, const char *text, size_t length)
+{
+    text_processor_reset(processor);
+    text_processor_feed(processor, text, length);
+    text_processor_finish(processor);
+}
+
+// 从流式读取器读到结束，返回 0 表示读错误（已统计的部分仍保留在 processor 中）
+int process_stream(TextProcessor *processor, StreamReader *reader)
+{
+    text_processor_reset(processor);
+    size_t n;
+    while ((n = stream_read(reader)) > 0)
+        text_processor_feed(processor, reader->buffer, n);
+    text_processor_finish(processor);
+    return !reader->error;
+}
+
+// ---------- 并行分块 ----------
+
+// 每个线程至少分到这么多字节，否则线程开销比计数本身还大
+#define SPP_PARALLEL_MIN_CHUNK (1u << 20)
+#define SPP_MAX_THREADS 256
+
+// 一个分块的部分结果：第 0 块接着处理器已有的状态算，其余每块都从“不在单词中”开始独立计数，
+// 所以还要记下首尾字符是否为空白，合并时修正跨块的单词
+typedef struct
+{
+    const unsigned char *text;
+    size_t length;
+    TextProcessor partial; // 与总处理器同一模式；line_count 此处只是换行符个数
+    int settle;            // 后面还有分块：块尾收尾挂起的 UTF-8 序列并结束校验
+    int first_space;
+    int last_space;
+} TextChunk;
+
+static void *count_chunk(void *arg)
+{
+    TextChunk *chunk = (TextChunk *)arg;
+    text_processor_feed(&chunk->partial, (const char *)chunk->text, chunk->length);
+    if (chunk->settle)
+        text_processor_settle(&chunk->partial);
+    chunk->first_space = chunk->partial.utf8 ? utf8_first_space(chunk->text, chunk->length)
+                                             : space_table[chunk->text[0]];
+    chunk->last_space = !chunk->partial.in_word;
+    return NULL;
+}
+
+static unsigned online_cpus(void)
+{
+#ifndef _WIN32
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0)
+        return (unsigned)n;
+#endif
+    return 1;
+}
+
+// 与 text_processor_feed 结果完全相同，只是把文本切成 threads 个连续分块并行计数，
+// 结束后处理器停在这段文本末尾的状态，可以继续 feed。
+// threads 为 0 时取在线 CPU 数；文本太短时退化为单线程。
+void text_processor_feed_parallel(TextProcessor *processor, const char *text, size_t length, unsigned threads)
+{
+    if (threads == 0)
+        threads = online_cpus();
+    if (threads > SPP_MAX_THREADS)
+        threads = SPP_MAX_THREADS;
+    if (text && length / SPP_PARALLEL_MIN_CHUNK < threads)
+        threads = (unsigned)(length / SPP_PARALLEL_MIN_CHUNK);
+    if (!text || threads <= 1)
+    {
+        text_processor_feed(processor, text, length);
+        return;
+    }
+
+    // 选择内核会写静态缓存，先在主线程里做掉，工作线程只读
+    select_count_kernel();
+    select_utf8_kernel();
+    select_validate_kernel();
+
+    // 切分点向后挪过续字节（最多 3 个），不把一个 UTF-8 字符切成两半
+    const unsigned char *p = (const unsigned char *)text;
+    TextChunk chunks[SPP_MAX_THREADS];
+    size_t start = 0;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        size_t end = i + 1 == threads ? length : length / threads * (i + 1);
+        for (int k = 0; k < 3 && end < length && (p[end] & 0xC0) == 0x80; ++k)
+            ++end;
+        chunks[i].text = p + start;
+        chunks[i].length = end - start;
+        chunks[i].partial = *processor;
+        if (i > 0)
+            text_processor_reset(&chunks[i].partial);
+        chunks[i].settle = i + 1 < threads;
+        start = end;
+    }
+
+#ifndef _WIN32
+    // 第 0 块由当前线程自己算；线程创建失败的块也就地计算
+    pthread_t tids[SPP_MAX_THREADS];
+    int started[SPP_MAX_THREADS] = {0};
+    for (unsigned i = 1; i < threads; ++i)
+        started[i] = pthread_create(&tids[i], NULL, count_chunk, &chunks[i]) == 0;
+    count_chunk(&chunks[0]);
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        else
+            count_chunk(&chunks[i]);
+    }
+#else
+    for (unsigned i = 0; i < threads; ++i)
+        count_chunk(&chunks[i]);
+#endif
+
+    // 合并：前一块以非空白结尾、后一块以非空白开头，说明同一个单词被切开了，
+    // 后一块把它又数了一次。末尾状态（单词、挂起序列、校验器）取最后一块的。
+    size_t words = 0, chars = 0, newlines = 0;
+    int invalid = 0;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        words += chunks[i].partial.word_count;
+        chars += chunks[i].partial.char_count;
+        newlines += chunks[i].partial.line_count;
+        invalid |= chunks[i].partial.validator.error;
+        if (i > 0 && !chunks[i - 1].last_space && !chunks[i].first_space)
+            --words;
+    }
+    *processor = chunks[threads - 1].partial;
+    processor->word_count = words;
+    processor->char_count = chars;
+    processor->line_count = newlines;
+    processor->validator.error |= invalid;
+}
+
+// 与 process_text 结果完全相同，见 text_processor_feed_parallel
+void process_text_parallel(TextProcessor *processor, const char *text, size_t length, unsigned threads)
+{
+    text_processor_reset(processor);
+    text_processor_feed_parallel(processor, text, length, threads);
+    text_processor_finish(processor);
+}
+
 void print_statistics(const TextProcessor *processor)
 {
     printf("文本统计信息:\n");
-    printf("  字符数: %d\n", processor->char_count);
-    printf("  单词数: %d\n", processor->word_count);
-    printf("  行数: %d\n", processor->line_count);
+    printf("  字符数: %zu\n", processor->char_count);
+    printf("  单词数: %zu\n", processor->word_count);
+    printf("  行数: %zu\n", processor->line_count);
+    if (processor->validate)
+        printf("  UTF-8 校验: %s\n", text_processor_valid(processor) ? "通过" : "不合法");
 }
 
 void destroy_text_processor(TextProcessor *processor)
@@ -150,9 +1040,11 @@ int save_statistics(DataSaver *saver, const TextProcessor *processor)
 
     fprintf(file, "文本统计报告\n");
     fprintf(file, "=============\n");
-    fprintf(file, "字符数: %d\n", processor->char_count);
-    fprintf(file, "单词数: %d\n", processor->word_count);
-    fprintf(file, "行数: %d\n", processor->line_count);
+    fprintf(file, "字符数: %zu\n", processor->char_count);
+    fprintf(file, "单词数: %zu\n", processor->word_count);
+    fprintf(file, "行数: %zu\n", processor->line_count);
+    if (processor->validate)
+        fprintf(file, "UTF-8 校验: %s\n", text_processor_valid(processor) ? "通过" : "不合法");
 
     fclose(file);
     printf("统计结果已保存到: %s\n", saver->output_filename);
@@ -168,28 +1060,1183 @@ void destroy_data_saver(DataSaver *saver)
     }
 }
 
-// ==================== 主程序 - 协调各个职责 ====================
+// ==================== 统计缓存职责 ====================
+
+#ifndef _WIN32
+
+// 统计缓存 - 只负责记住每个文件统计到哪里、停在什么状态，以便追加写的文件下次只扫新增部分。
+// 以路径为键，用设备号 + inode 认文件，用大小 + mtime 判断是否变化；
+// 变化了还要核对整个已统计部分的校验和，对不上（截断、任何位置的改写）就整体重算。
+// 核对只是一遍顺序哈希、不分词；校验和可以接着往后算，续算完新记录时只补哈希新增的部分。
+// 缓存是文本文件，每行一条，制表符分隔，路径放最后（含制表符或换行的路径不缓存）；写回时先写临时文件再改名。
+#define SPP_CACHE_CHUNK 65536
 
-int main()
+typedef struct
 {
-    const char *input_file = "input.txt";
-    const char *output_file = "statistics.txt";
+    char *path;
+    uint64_t dev, ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    int utf8;
+    uint64_t offset; // 已统计到的位置
+    // offset 处、finish 之前的处理器状态
+    size_t word_count, char_count, newline_count;
+    int in_word;
+    uint32_t pending_cp;
+    int pending_need;
+    uint64_t prefix_hash; // [0, offset) 的 FNV-1a 校验和
+} StatsCacheEntry;
 
-    // 1. 文件读取职责
-    FileReader *file_reader = create_file_reader();
-    if (!read_file(file_reader, input_file))
-    {
-        printf("文件读取失败\n");
+typedef struct
+{
+    char *filename;
+    StatsCacheEntry *entries;
+    size_t count, capacity;
+    size_t *index; // 路径哈希的开放寻址表，存 entries 下标 + 1，0 为空
+    size_t index_capacity;
+} StatsCache;
+
+static uint64_t fnv1a64(const void *data, size_t len, uint64_t hash)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    return hash;
+}
+#define SPP_FNV_OFFSET 0xcbf29ce484222325ull
+
+static void stats_cache_index_insert(size_t *index, size_t capacity, const StatsCacheEntry *entries, size_t i)
+{
+    size_t slot = fnv1a64(entries[i].path, strlen(entries[i].path), SPP_FNV_OFFSET);
+    while (index[slot & (capacity - 1)])
+        ++slot;
+    index[slot & (capacity - 1)] = i + 1;
+}
+
+// 装载率保持在一半以下
+static int stats_cache_reindex(StatsCache *cache)
+{
+    size_t capacity = 64;
+    while (capacity < cache->count * 2)
+        capacity *= 2;
+    size_t *index = (size_t *)calloc(capacity, sizeof(size_t));
+    if (!index)
+        return 0;
+    for (size_t i = 0; i < cache->count; ++i)
+        stats_cache_index_insert(index, capacity, cache->entries, i);
+    free(cache->index);
+    cache->index = index;
+    cache->index_capacity = capacity;
+    return 1;
+}
+
+StatsCacheEntry *stats_cache_find(const StatsCache *cache, const char *path)
+{
+    if (!cache->index_capacity)
+        return NULL;
+    size_t mask = cache->index_capacity - 1;
+    for (size_t slot = fnv1a64(path, strlen(path), SPP_FNV_OFFSET);; ++slot)
+    {
+        size_t i = cache->index[slot & mask];
+        if (!i)
+            return NULL;
+        if (strcmp(cache->entries[i - 1].path, path) == 0)
+            return &cache->entries[i - 1];
+    }
+}
+
+// 新增或覆盖同一路径的记录；entry->path 由缓存复制
+int stats_cache_put(StatsCache *cache, const StatsCacheEntry *entry)
+{
+    StatsCacheEntry *old = stats_cache_find(cache, entry->path);
+    if (old)
+    {
+        char *path = old->path;
+        *old = *entry;
+        old->path = path;
+        return 1;
+    }
+    if (cache->count == cache->capacity)
+    {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+        StatsCacheEntry *entries = (StatsCacheEntry *)realloc(cache->entries, capacity * sizeof(StatsCacheEntry));
+        if (!entries)
+            return 0;
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    char *path = strdup(entry->path);
+    if (!path)
+        return 0;
+    cache->entries[cache->count] = *entry;
+    cache->entries[cache->count++].path = path;
+    if (cache->count * 2 > cache->index_capacity)
+        return stats_cache_reindex(cache);
+    stats_cache_index_insert(cache->index, cache->index_capacity, cache->entries, cache->count - 1);
+    return 1;
+}
+
+// 读一个以制表符结尾的无符号字段（base 为 10 或 16），不接受空白、符号和溢出
+static int cache_field_u64(char **cursor, int base, uint64_t *out)
+{
+    char *s = *cursor, *end;
+    int digit = (*s >= '0' && *s <= '9') || (base == 16 && ((*s >= 'a' && *s <= 'f') || (*s >= 'A' && *s <= 'F')));
+    if (!digit)
+        return 0;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, base);
+    if (errno || *end != '\t')
+        return 0;
+    *out = (uint64_t)v;
+    *cursor = end + 1;
+    return 1;
+}
+
+static int cache_field_i64(char **cursor, int64_t *out)
+{
+    int negative = **cursor == '-';
+    uint64_t v;
+    *cursor += negative;
+    if (!cache_field_u64(cursor, 10, &v) || v > (uint64_t)INT64_MAX)
+        return 0;
+    *out = negative ? -(int64_t)v : (int64_t)v;
+    return 1;
+}
+
+// 解析一行（已去掉换行符）。字段必须恰好以单个制表符分隔、取值在合法范围内，
+// 路径非空且不含制表符；任何一处不符都整行作废，而不是按错位的字段去续算。
+static int parse_stats_cache_line(char *line, StatsCacheEntry *e)
+{
+    uint64_t f[14];
+    char *cursor = line;
+    if (!cache_field_u64(&cursor, 10, &f[0]) || !cache_field_u64(&cursor, 10, &f[1]) ||
+        !cache_field_u64(&cursor, 10, &f[2]) || !cache_field_i64(&cursor, &e->mtime_sec))
+        return 0;
+    for (int i = 4; i < 13; ++i)
+        if (!cache_field_u64(&cursor, 10, &f[i]))
+            return 0;
+    if (!cache_field_u64(&cursor, 16, &f[13]))
+        return 0;
+    if (!*cursor || strchr(cursor, '\t'))
+        return 0;
+    // f[4] mtime_nsec, f[5] utf8, f[6] offset, f[7..9] 计数, f[10] in_word, f[11] pending_cp, f[12] pending_need
+    if (f[4] > 999999999 || f[5] > 1 || f[6] > f[2] || f[7] > SIZE_MAX || f[8] > SIZE_MAX || f[9] > SIZE_MAX ||
+        f[10] > 1 || f[11] > 0xFFFF || f[12] > 2)
+        return 0;
+    e->dev = f[0];
+    e->ino = f[1];
+    e->size = f[2];
+    e->mtime_nsec = (long)f[4];
+    e->utf8 = (int)f[5];
+    e->offset = f[6];
+    e->word_count = (size_t)f[7];
+    e->char_count = (size_t)f[8];
+    e->newline_count = (size_t)f[9];
+    e->in_word = (int)f[10];
+    e->pending_cp = (uint32_t)f[11];
+    e->pending_need = (int)f[12];
+    e->prefix_hash = f[13];
+    e->path = cursor;
+    return 1;
+}
+
+// 缓存文件不存在时得到空缓存；格式不对的行（含没有换行符的残行）忽略
+StatsCache *load_stats_cache(const char *filename)
+{
+    StatsCache *cache = (StatsCache *)calloc(1, sizeof(StatsCache));
+    if (!cache || !(cache->filename = strdup(filename)))
+    {
+        free(cache);
+        return NULL;
+    }
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return cache;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, file)) > 0)
+    {
+        if (line[len - 1] != '\n')
+            continue;
+        line[--len] = '\0';
+        StatsCacheEntry e;
+        if ((size_t)len != strlen(line) || !parse_stats_cache_line(line, &e))
+            continue; // 行内有 NUL 或字段不合法
+        stats_cache_put(cache, &e);
+    }
+    free(line);
+    fclose(file);
+    return cache;
+}
+
+int save_stats_cache(const StatsCache *cache)
+{
+    size_t len = strlen(cache->filename) + 5;
+    char *tmp = (char *)malloc(len);
+    if (!tmp)
+        return 0;
+    snprintf(tmp, len, "%s.tmp", cache->filename);
+    FILE *file = fopen(tmp, "w");
+    if (!file)
+    {
+        printf("无法写入缓存: %s\n", tmp);
+        free(tmp);
+        return 0;
+    }
+    for (size_t i = 0; i < cache->count; ++i)
+    {
+        const StatsCacheEntry *e = &cache->entries[i];
+        if (strpbrk(e->path, "\t\n"))
+            continue; // 格式里路径既不转义也不带长度，含分隔符的路径不落盘（下次整体重算）
+        fprintf(file,
+                "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRId64 "\t%ld\t%d\t%" PRIu64 "\t%zu\t%zu\t%zu\t%d\t%" PRIu32
+                "\t%d\t%" PRIx64 "\t%s\n",
+                e->dev, e->ino, e->size, e->mtime_sec, e->mtime_nsec, e->utf8, e->offset, e->word_count,
+                e->char_count, e->newline_count, e->in_word, e->pending_cp, e->pending_need, e->prefix_hash,
+                e->path);
+    }
+    int ok = fflush(file) == 0 && !ferror(file);
+    ok = fclose(file) == 0 && ok && rename(tmp, cache->filename) == 0;
+    if (!ok)
+        remove(tmp);
+    free(tmp);
+    return ok;
+}
+
+void destroy_stats_cache(StatsCache *cache)
+{
+    if (cache)
+    {
+        for (size_t i = 0; i < cache->count; ++i)
+            free(cache->entries[i].path);
+        free(cache->entries);
+        free(cache->index);
+        free(cache->filename);
+        free(cache);
+    }
+}
+
+// 计算校验和用的数据来源：映射区或描述符（pread）。
+// hashed/hash 记录已经算过的前缀 [0, hashed) 的校验和，由 resume 填好、record 接着往后算。
+typedef struct
+{
+    const char *content;
+    int fd;
+    uint64_t hashed;
+    uint64_t hash;
+} CacheSource;
+
+// 把 src 的校验和从 hashed 续算到 end
+static int cache_source_extend(CacheSource *src, uint64_t end)
+{
+    if (src->hashed == 0)
+        src->hash = SPP_FNV_OFFSET;
+    if (src->content)
+    {
+        src->hash = fnv1a64(src->content + src->hashed, (size_t)(end - src->hashed), src->hash);
+        src->hashed = end;
+        return 1;
+    }
+    char buf[SPP_CACHE_CHUNK];
+    while (src->hashed < end)
+    {
+        size_t want = end - src->hashed < sizeof(buf) ? (size_t)(end - src->hashed) : sizeof(buf);
+        ssize_t n = pread(src->fd, buf, want, (off_t)src->hashed);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        src->hash = fnv1a64(buf, (size_t)n, src->hash);
+        src->hashed += (uint64_t)n;
+    }
+    return 1;
+}
+
+// 处理器刚 reset 时调用，length 为文件当前可读的长度：能续算就把状态恢复到缓存的位置并返回该位置，
+// 否则返回 0（从头扫）。校验模式不走缓存，校验器的中间状态不落盘。
+uint64_t stats_cache_resume(const StatsCache *cache, const char *path, const struct stat *st, uint64_t length,
+                            CacheSource *src, TextProcessor *processor)
+{
+    src->hashed = 0;
+    const StatsCacheEntry *e = stats_cache_find(cache, path);
+    if (!e || processor->validate || e->utf8 != processor->utf8 || e->dev != (uint64_t)st->st_dev ||
+        e->ino != (uint64_t)st->st_ino || length < e->offset)
+        return 0;
+    int unchanged = e->size == length && e->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+                    e->mtime_nsec == st->st_mtim.tv_nsec;
+    if (!unchanged && (!cache_source_extend(src, e->offset) || src->hash != e->prefix_hash))
+    {
+        src->hashed = 0; // 已算的哈希作废，record 时从头算
+        return 0;
+    }
+    src->hashed = e->offset;
+    src->hash = e->prefix_hash;
+    processor->word_count = e->word_count;
+    processor->char_count = e->char_count;
+    processor->line_count = e->newline_count;
+    processor->in_word = e->in_word;
+    processor->pending_cp = e->pending_cp;
+    processor->pending_need = e->pending_need;
+    return e->offset;
+}
+
+// 记下统计到 length 处、finish 之前的处理器状态；entry->path 借用 path，不复制
+int stats_cache_record(StatsCacheEntry *entry, const char *path, const struct stat *st, uint64_t length,
+                       CacheSource *src, const TextProcessor *processor)
+{
+    if (processor->validate)
+        return 0;
+    entry->path = (char *)path;
+    entry->dev = (uint64_t)st->st_dev;
+    entry->ino = (uint64_t)st->st_ino;
+    entry->size = length;
+    entry->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->utf8 = processor->utf8;
+    entry->offset = length;
+    entry->word_count = processor->word_count;
+    entry->char_count = processor->char_count;
+    entry->newline_count = processor->line_count;
+    entry->in_word = processor->in_word;
+    entry->pending_cp = processor->pending_cp;
+    entry->pending_need = processor->pending_need;
+    if (!cache_source_extend(src, entry->offset))
+        return 0;
+    entry->prefix_hash = src->hash;
+    return 1;
+}
+
+#endif // _WIN32
+
+// ==================== 批量统计职责 ====================
+
+#ifndef _WIN32
+
+// 文件清单 - 只负责收集要统计的路径：清单文件（每行一个路径，"-" 为标准输入）或目录（递归，只收普通文件）
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+static int file_list_add(FileList *list, const char *path)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        char **paths = (char **)realloc(list->paths, capacity * sizeof(char *));
+        if (!paths)
+            return 0;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy)
+        return 0;
+    list->paths[list->count++] = copy;
+    return 1;
+}
+
+static int file_list_walk(FileList *list, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        printf("无法打开目录: %s\n", dir);
+        return 0;
+    }
+    int ok = 1;
+    size_t dir_len = strlen(dir);
+    struct dirent *entry;
+    while (ok && (entry = readdir(d)))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        size_t len = dir_len + 1 + strlen(entry->d_name) + 1;
+        char *path = (char *)malloc(len);
+        if (!path)
+        {
+            ok = 0;
+            break;
+        }
+        snprintf(path, len, "%s%s%s", dir, dir[dir_len - 1] == '/' ? "" : "/", entry->d_name);
+        struct stat st;
+        if (lstat(path, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+                ok = file_list_walk(list, path);
+            else if (S_ISREG(st.st_mode))
+                ok = file_list_add(list, path);
+        }
+        free(path);
+    }
+    closedir(d);
+    return ok;
+}
+
+static int file_list_read(FileList *list, const char *listfile)
+{
+    FILE *file = strcmp(listfile, "-") == 0 ? stdin : fopen(listfile, "r");
+    if (!file)
+    {
+        printf("无法打开文件清单: %s\n", listfile);
+        return 0;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int ok = 1;
+    while (ok && (len = getline(&line, &size, file)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len > 0)
+            ok = file_list_add(list, line);
+    }
+    free(line);
+    if (file != stdin)
+        fclose(file);
+    return ok;
+}
+
+// source 是目录就递归收集，否则当作清单文件
+FileList *create_file_list(const char *source)
+{
+    FileList *list = (FileList *)calloc(1, sizeof(FileList));
+    if (!list)
+        return NULL;
+    struct stat st;
+    int is_dir = strcmp(source, "-") != 0 && stat(source, &st) == 0 && S_ISDIR(st.st_mode);
+    if (!(is_dir ? file_list_walk(list, source) : file_list_read(list, source)))
+    {
+        for (size_t i = 0; i < list->count; ++i)
+            free(list->paths[i]);
+        free(list->paths);
+        free(list);
+        return NULL;
+    }
+    return list;
+}
+
+void destroy_file_list(FileList *list)
+{
+    if (list)
+    {
+        for (size_t i = 0; i < list->count; ++i)
+            free(list->paths[i]);
+        free(list->paths);
+        free(list);
+    }
+}
+
+// 批量统计 - 只负责调度读取与计数：每个文件一个 TextProcessor，最后汇总。
+// 读缓冲区来自固定大小的池，同时在途的文件数等于缓冲区个数。
+#define SPP_BATCH_BUFFER (128 * 1024)
+#define SPP_BATCH_DEPTH 64  // io_uring：同时在途的文件数
+#define SPP_BATCH_THREADS 8 // pread 线程池的默认线程数
+
+typedef struct
+{
+    TextProcessor stats;
+    int error; // 0 或 errno
+    // 启用缓存时：本次统计后的缓存记录（entry.path 即 key，由 realpath 分配）和续算跳过的字节数
+    int recorded;
+    StatsCacheEntry entry;
+    uint64_t skipped;
+} BatchResult;
+
+typedef struct
+{
+    const FileList *files;
+    BatchResult *results;
+    TextProcessor total;
+    size_t failed;
+    uint64_t skipped;
+    const char *engine;      // "io_uring" / "pread"
+    const StatsCache *cache; // 可选；运行期间只读，结束后由调用方写回
+} BatchStats;
+
+BatchStats *create_batch_stats(const FileList *files, int utf8, int validate)
+{
+    BatchStats *batch = (BatchStats *)calloc(1, sizeof(BatchStats));
+    if (!batch)
+        return NULL;
+    batch->files = files;
+    batch->results = (BatchResult *)calloc(files->count ? files->count : 1, sizeof(BatchResult));
+    if (!batch->results)
+    {
+        free(batch);
+        return NULL;
+    }
+    text_processor_set_utf8(&batch->total, utf8, validate);
+    for (size_t i = 0; i < files->count; ++i)
+    {
+        batch->results[i].stats = batch->total;
+        text_processor_reset(&batch->results[i].stats);
+    }
+    text_processor_reset(&batch->total);
+    return batch;
+}
+
+void destroy_batch_stats(BatchStats *batch)
+{
+    if (batch)
+    {
+        for (size_t i = 0; i < batch->files->count; ++i)
+            free(batch->results[i].entry.path);
+        free(batch->results);
+        free(batch);
+    }
+}
+
+static void batch_summarize(BatchStats *batch)
+{
+    TextProcessor *total = &batch->total;
+    text_processor_reset(total);
+    batch->failed = 0;
+    batch->skipped = 0;
+    for (size_t i = 0; i < batch->files->count; ++i)
+    {
+        const BatchResult *r = &batch->results[i];
+        if (r->error)
+        {
+            ++batch->failed;
+            continue;
+        }
+        batch->skipped += r->skipped;
+        total->word_count += r->stats.word_count;
+        total->char_count += r->stats.char_count;
+        total->line_count += r->stats.line_count;
+        total->validator.error |= !text_processor_valid(&r->stats);
+    }
+}
+
+// ---------- pread 线程池 ----------
+
+typedef struct
+{
+    BatchStats *batch;
+    atomic_size_t next; // 下一个待处理的文件下标
+} BatchPool;
+
+typedef struct
+{
+    BatchPool *pool;
+    char *buffer;
+} BatchWorker;
+
+static void *batch_worker(void *arg)
+{
+    BatchWorker *worker = (BatchWorker *)arg;
+    BatchStats *batch = worker->pool->batch;
+    size_t i;
+    while ((i = atomic_fetch_add(&worker->pool->next, 1)) < batch->files->count)
+    {
+        BatchResult *r = &batch->results[i];
+        int fd = open(batch->files->paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            r->error = errno;
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        off_t offset = 0;
+        struct stat st;
+        CacheSource src = {NULL, fd, 0, 0};
+        if (batch->cache && fstat(fd, &st) == 0 && (r->entry.path = realpath(batch->files->paths[i], NULL)))
+            offset = (off_t)stats_cache_resume(batch->cache, r->entry.path, &st, (uint64_t)st.st_size, &src, &r->stats);
+        r->skipped = (uint64_t)offset;
+        for (;;)
+        {
+            ssize_t n = pread(fd, worker->buffer, SPP_BATCH_BUFFER, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                if (n < 0)
+                    r->error = errno;
+                break;
+            }
+            text_processor_feed(&r->stats, worker->buffer, (size_t)n);
+            offset += n;
+        }
+        if (r->entry.path && !r->error)
+            r->recorded = stats_cache_record(&r->entry, r->entry.path, &st, (uint64_t)offset, &src, &r->stats);
+        text_processor_finish(&r->stats);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int batch_run_pread(BatchStats *batch, unsigned threads)
+{
+    if (threads == 0)
+        threads = online_cpus();
+    if (threads > SPP_MAX_THREADS)
+        threads = SPP_MAX_THREADS;
+    char *buffers = (char *)malloc((size_t)threads * SPP_BATCH_BUFFER);
+    if (!buffers)
+        return 0;
+    BatchPool pool;
+    pool.batch = batch;
+    atomic_init(&pool.next, 0);
+    BatchWorker workers[SPP_MAX_THREADS];
+    pthread_t tids[SPP_MAX_THREADS];
+    int started[SPP_MAX_THREADS] = {0};
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers[t].pool = &pool;
+        workers[t].buffer = buffers + (size_t)t * SPP_BATCH_BUFFER;
+        if (t > 0)
+            started[t] = pthread_create(&tids[t], NULL, batch_worker, &workers[t]) == 0;
+    }
+    batch_worker(&workers[0]);
+    for (unsigned t = 1; t < threads; ++t)
+        if (started[t])
+            pthread_join(tids[t], NULL);
+    free(buffers);
+    batch->engine = "pread";
+    return 1;
+}
+
+// ---------- io_uring 流水线 ----------
+
+#ifdef SPP_HAVE_IO_URING
+// 不依赖 liburing，直接用系统调用和映射出来的环。
+// 每个在途文件占一个槽位（和一块缓冲区），依次经历 打开 → 读 …… 读到 0 → 关闭，
+// 同一时刻每个槽位最多一个请求在内核里；主线程在两次 io_uring_enter 之间计数，
+// 计数的同时其他槽位的读仍在进行。
+typedef struct
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned to_submit;
+} UringQueue;
+
+enum
+{
+    URING_SLOT_OPEN,
+    URING_SLOT_READ,
+    URING_SLOT_CLOSE
+};
+
+typedef struct
+{
+    size_t file;
+    const char *path;
+    int state;
+    int fd;
+    uint64_t offset;
+    char *buffer;
+} UringSlot;
+
+static void uring_queue_release(UringQueue *q)
+{
+    if (q->sqes && q->sqes != MAP_FAILED)
+        munmap(q->sqes, q->sqes_size);
+    if (q->cq_ring && q->cq_ring != MAP_FAILED && q->cq_ring != q->sq_ring)
+        munmap(q->cq_ring, q->cq_ring_size);
+    if (q->sq_ring && q->sq_ring != MAP_FAILED)
+        munmap(q->sq_ring, q->sq_ring_size);
+    if (q->fd >= 0)
+        close(q->fd);
+}
+
+// 内核不支持 io_uring、被 seccomp 禁止或缺少所需操作码时返回 0，由调用方退回 pread
+static int uring_queue_init(UringQueue *q, unsigned entries)
+{
+    memset(q, 0, sizeof *q);
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    q->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (q->fd < 0)
+        return 0;
+
+    q->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    q->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (q->cq_ring_size > q->sq_ring_size)
+            q->sq_ring_size = q->cq_ring_size;
+        q->cq_ring_size = q->sq_ring_size;
+    }
+    q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd,
+                      IORING_OFF_SQ_RING);
+    if (q->sq_ring == MAP_FAILED)
+        goto fail;
+    q->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                     ? q->sq_ring
+                     : mmap(NULL, q->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd,
+                            IORING_OFF_CQ_RING);
+    if (q->cq_ring == MAP_FAILED)
+        goto fail;
+    q->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = (struct io_uring_sqe *)mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          q->fd, IORING_OFF_SQES);
+    if (q->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = (char *)q->sq_ring, *cq = (char *)q->cq_ring;
+    q->sq_head = (unsigned *)(void *)(sq + params.sq_off.head);
+    q->sq_tail = (unsigned *)(void *)(sq + params.sq_off.tail);
+    q->sq_mask = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+    q->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+    q->cq_head = (unsigned *)(void *)(cq + params.cq_off.head);
+    q->cq_tail = (unsigned *)(void *)(cq + params.cq_off.tail);
+    q->cq_mask = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(void *)(cq + params.cq_off.cqes);
+    for (unsigned i = 0; i < params.sq_entries; ++i)
+        q->sq_array[i] = i; // SQE 下标与环位置一一对应
+
+    // OPENAT/READ/CLOSE 自 5.6 起才有，用探测确认
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    int supported = probe && syscall(__NR_io_uring_register, q->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_CLOSE && probe->last_op >= IORING_OP_READ &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (supported)
+        return 1;
+fail:
+    uring_queue_release(q);
+    return 0;
+}
+
+// 取一个空的 SQE；槽位数不超过环大小，所以不会满
+static struct io_uring_sqe *uring_get_sqe(UringQueue *q)
+{
+    unsigned tail = *q->sq_tail + q->to_submit;
+    struct io_uring_sqe *sqe = &q->sqes[tail & *q->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    ++q->to_submit;
+    return sqe;
+}
+
+// 发布已填好的 SQE，并等待至少 wait_nr 个完成
+static int uring_submit_and_wait(UringQueue *q, unsigned wait_nr)
+{
+    __atomic_store_n(q->sq_tail, *q->sq_tail + q->to_submit, __ATOMIC_RELEASE);
+    unsigned to_submit = q->to_submit;
+    q->to_submit = 0;
+    for (;;)
+    {
+        long ret = syscall(__NR_io_uring_enter, q->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0)
+            return 1;
+        if (errno != EINTR)
+            return 0;
+        to_submit = 0; // 被信号打断时提交已经完成，只需继续等待
+    }
+}
+
+static void uring_prep(UringQueue *q, UringSlot *slots, unsigned slot)
+{
+    UringSlot *s = &slots[slot];
+    struct io_uring_sqe *sqe = uring_get_sqe(q);
+    sqe->user_data = slot;
+    switch (s->state)
+    {
+    case URING_SLOT_OPEN:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)s->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        break;
+    case URING_SLOT_READ:
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = s->fd;
+        sqe->addr = (uint64_t)(uintptr_t)s->buffer;
+        sqe->len = SPP_BATCH_BUFFER;
+        sqe->off = s->offset;
+        break;
+    case URING_SLOT_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = s->fd;
+        break;
+    }
+}
+
+static int batch_run_uring(BatchStats *batch)
+{
+    UringQueue q;
+    if (!uring_queue_init(&q, SPP_BATCH_DEPTH))
+        return 0;
+    char *buffers = (char *)malloc((size_t)SPP_BATCH_DEPTH * SPP_BATCH_BUFFER);
+    if (!buffers)
+    {
+        uring_queue_release(&q);
+        return 0;
+    }
+
+    UringSlot slots[SPP_BATCH_DEPTH];
+    unsigned free_slots[SPP_BATCH_DEPTH], nfree = SPP_BATCH_DEPTH;
+    for (unsigned i = 0; i < SPP_BATCH_DEPTH; ++i)
+    {
+        slots[i].buffer = buffers + (size_t)i * SPP_BATCH_BUFFER;
+        free_slots[i] = SPP_BATCH_DEPTH - 1 - i;
+    }
+
+    const FileList *files = batch->files;
+    size_t next = 0, active = 0;
+    int ok = 1;
+    while (ok && (next < files->count || active))
+    {
+        // 有空槽位就开始打开下一个文件
+        while (nfree && next < files->count)
+        {
+            unsigned slot = free_slots[--nfree];
+            slots[slot].file = next;
+            slots[slot].path = files->paths[next++];
+            slots[slot].state = URING_SLOT_OPEN;
+            slots[slot].offset = 0;
+            uring_prep(&q, slots, slot);
+            ++active;
+        }
+        if (!uring_submit_and_wait(&q, 1))
+        {
+            ok = 0;
+            break;
+        }
+
+        unsigned head = *q.cq_head;
+        unsigned tail = __atomic_load_n(q.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe *cqe = &q.cqes[head & *q.cq_mask];
+            unsigned slot = (unsigned)cqe->user_data;
+            int res = cqe->res;
+            UringSlot *s = &slots[slot];
+            BatchResult *r = &batch->results[s->file];
+            switch (s->state)
+            {
+            case URING_SLOT_OPEN:
+                if (res < 0)
+                {
+                    r->error = -res;
+                    free_slots[nfree++] = slot;
+                    --active;
+                    continue;
+                }
+                s->fd = res;
+                s->state = URING_SLOT_READ;
+                break;
+            case URING_SLOT_READ:
+                if (res == -EINTR || res == -EAGAIN)
+                    break; // 原样重发
+                if (res > 0)
+                {
+                    text_processor_feed(&r->stats, s->buffer, (size_t)res);
+                    s->offset += (uint64_t)res;
+                    break;
+                }
+                if (res < 0)
+                    r->error = -res;
+                text_processor_finish(&r->stats);
+                s->state = URING_SLOT_CLOSE;
+                break;
+            case URING_SLOT_CLOSE:
+                free_slots[nfree++] = slot;
+                --active;
+                continue;
+            }
+            uring_prep(&q, slots, slot);
+        }
+        __atomic_store_n(q.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (!ok)
+    {
+        // 出错时关闭 ring 会取消仍在途的请求；已打开的文件自己关
+        for (unsigned i = 0; i < SPP_BATCH_DEPTH; ++i)
+        {
+            int in_use = 1;
+            for (unsigned k = 0; k < nfree; ++k)
+                in_use &= free_slots[k] != i;
+            if (in_use && slots[i].state == URING_SLOT_READ)
+                close(slots[i].fd);
+        }
+    }
+    free(buffers);
+    uring_queue_release(&q);
+    batch->engine = "io_uring";
+    return ok;
+}
+#endif
+
+// 优先走 io_uring，不可用时退回 pread 线程池。
+// 启用缓存时直接用 pread 线程池：续算要先 fstat 并核对校验和，由各线程同步完成。
+int run_batch(BatchStats *batch, unsigned threads)
+{
+    int ok = 0;
+#ifdef SPP_HAVE_IO_URING
+    if (!batch->cache)
+        ok = batch_run_uring(batch);
+#endif
+    if (!ok)
+    {
+        // io_uring 中途失败时可能已统计了一部分，从头再来
+        for (size_t i = 0; i < batch->files->count; ++i)
+        {
+            text_processor_reset(&batch->results[i].stats);
+            batch->results[i].error = 0;
+            batch->results[i].recorded = 0;
+        }
+        ok = batch_run_pread(batch, threads);
+    }
+    if (ok)
+        batch_summarize(batch);
+    return ok;
+}
+
+// 汇总报告加逐文件明细（字符数、单词数、行数、路径）
+int save_batch_statistics(DataSaver *saver, const BatchStats *batch)
+{
+    FILE *file = fopen(saver->output_filename, "w");
+    if (!file)
+    {
+        printf("无法创建输出文件: %s\n", saver->output_filename);
+        return 0;
+    }
+
+    const TextProcessor *total = &batch->total;
+    fprintf(file, "文本统计报告（%zu 个文件，失败 %zu 个）\n", batch->files->count, batch->failed);
+    fprintf(file, "=============\n");
+    fprintf(file, "字符数: %zu\n", total->char_count);
+    fprintf(file, "单词数: %zu\n", total->word_count);
+    fprintf(file, "行数: %zu\n", total->line_count);
+    if (total->validate)
+        fprintf(file, "UTF-8 校验: %s\n", text_processor_valid(total) ? "通过" : "不合法");
+
+    fprintf(file, "\n字符数\t单词数\t行数\t文件\n");
+    for (size_t i = 0; i < batch->files->count; ++i)
+    {
+        const BatchResult *r = &batch->results[i];
+        if (r->error)
+            fprintf(file, "-\t-\t-\t%s\t%s\n", batch->files->paths[i], strerror(r->error));
+        else
+            fprintf(file, "%zu\t%zu\t%zu\t%s%s\n", r->stats.char_count, r->stats.word_count, r->stats.line_count,
+                    batch->files->paths[i], text_processor_valid(&r->stats) ? "" : "\tUTF-8 不合法");
+    }
+
+    fclose(file);
+    printf("统计结果已保存到: %s\n", saver->output_filename);
+    return 1;
+}
+
+#endif // _WIN32
+
+// ==================== 主程序 - 协调各个职责 ====================
+
+// 超过这个长度的内容不再整段回显
+#define SPP_PREVIEW_MAX 4096
+
+// 批量模式：收集文件 → 批量统计 → 保存汇总与明细
+#ifndef _WIN32
+// 带缓存的文本处理：能续算就只扫新增部分，统计完把进度写回缓存
+static void process_text_cached(TextProcessor *processor, const char *path, const FileReader *reader, unsigned threads,
+                                const char *cache_file)
+{
+    StatsCache *cache = load_stats_cache(cache_file);
+    char *key = realpath(path, NULL);
+    struct stat st;
+    if (!cache || !key || stat(path, &st) != 0)
+    {
+        printf("缓存不可用，完整统计\n");
+        process_text_parallel(processor, reader->content, reader->length, threads);
+        free(key);
+        destroy_stats_cache(cache);
+        return;
+    }
+
+    CacheSource src = {reader->content, -1, 0, 0};
+    text_processor_reset(processor);
+    uint64_t offset = stats_cache_resume(cache, key, &st, reader->length, &src, processor);
+    text_processor_feed_parallel(processor, reader->content + offset, reader->length - (size_t)offset, threads);
+    StatsCacheEntry entry;
+    if (stats_cache_record(&entry, key, &st, reader->length, &src, processor) && stats_cache_put(cache, &entry))
+        save_stats_cache(cache);
+    text_processor_finish(processor);
+    printf("缓存: 跳过已统计的 %" PRIu64 " 字节，本次扫描 %zu 字节\n", offset, reader->length - (size_t)offset);
+
+    free(key);
+    destroy_stats_cache(cache);
+}
+#endif
+
+// 未指定 -j 时 pread 线程池用 SPP_BATCH_THREADS 个线程
+static int batch_main(const char *source, const char *output_file, int utf8, int validate, unsigned threads,
+                      int threads_set, const char *cache_file)
+{
+#ifndef _WIN32
+    if (!threads_set)
+        threads = SPP_BATCH_THREADS;
+    FileList *files = create_file_list(source);
+    if (!files)
+    {
+        printf("文件清单读取失败\n");
+        return 1;
+    }
+    StatsCache *cache = cache_file ? load_stats_cache(cache_file) : NULL;
+    BatchStats *batch = create_batch_stats(files, utf8, validate);
+    if (batch)
+        batch->cache = cache;
+    if (!batch || !run_batch(batch, threads))
+    {
+        printf("批量统计失败\n");
+        destroy_batch_stats(batch);
+        destroy_stats_cache(cache);
+        destroy_file_list(files);
+        return 1;
+    }
+
+    printf("批量统计 %zu 个文件（%s），失败 %zu 个\n", files->count, batch->engine, batch->failed);
+    if (cache)
+    {
+        for (size_t i = 0; i < files->count; ++i)
+            if (batch->results[i].recorded)
+                stats_cache_put(cache, &batch->results[i].entry);
+        save_stats_cache(cache);
+        printf("缓存: 跳过已统计的 %" PRIu64 " 字节\n", batch->skipped);
+    }
+    print_statistics(&batch->total);
+    DataSaver *data_saver = create_data_saver(output_file);
+    save_batch_statistics(data_saver, batch);
+
+    int status = batch->failed ? 1 : text_processor_valid(&batch->total) ? 0 : 2;
+    destroy_data_saver(data_saver);
+    destroy_batch_stats(batch);
+    destroy_stats_cache(cache);
+    destroy_file_list(files);
+    return status;
+#else
+    (void)source, (void)output_file, (void)utf8, (void)validate, (void)threads, (void)threads_set, (void)cache_file;
+    printf("批量模式仅支持 POSIX 系统\n");
+    return 1;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    const char *input_file = "input.txt";
+    const char *output_file = "statistics.txt";
+    const char *batch_source = NULL;
+    const char *cache_file = NULL;
+    unsigned threads = 1;
+    int threads_set = 0;
+    int streaming = 0;
+    int utf8 = 0, validate = 0;
+
+    int pos = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = (unsigned)strtoul(argv[++i], NULL, 10), threads_set = 1;
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2])
+            threads = (unsigned)strtoul(argv[i] + 2, NULL, 10), threads_set = 1;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_source = argv[++i];
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_file = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0)
+            streaming = 1;
+        else if (strcmp(argv[i], "--utf8") == 0)
+            utf8 = 1;
+        else if (strcmp(argv[i], "--validate") == 0)
+            validate = 1;
+        else if (pos == 0)
+            input_file = argv[i], ++pos;
+        else if (pos == 1)
+            output_file = argv[i], ++pos;
+        else
+        {
+            fprintf(stderr,
+                    "用法: %s [-j 线程数] [--stream] [--utf8] [--validate] [--cache 缓存文件] [输入文件] [输出文件]\n"
+                    "      %s [-j 线程数] [--utf8] [--validate] [--cache 缓存文件] --batch 目录或清单文件 [输出文件]\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch_source)
+    {
+        // 批量模式下唯一的位置参数是输出文件
+        if (pos == 2)
+        {
+            fprintf(stderr, "批量模式只接受一个输出文件参数\n");
+            return 1;
+        }
+        return batch_main(batch_source, pos == 1 ? input_file : output_file, utf8, validate, threads, threads_set,
+                          cache_file);
+    }
+
+    // 标准输入和非普通文件（管道、FIFO、设备）不能映射，边读边统计
+    if (strcmp(input_file, "-") == 0)
+        streaming = 1;
+#ifndef _WIN32
+    struct stat st;
+    if (!streaming && stat(input_file, &st) == 0 && !S_ISREG(st.st_mode))
+        streaming = 1;
+#endif
+
+    TextProcessor *text_processor = create_text_processor();
+    text_processor_set_utf8(text_processor, utf8, validate);
+    if (streaming)
+    {
+        // 1+2. 流式读取与处理：内存只有一个固定大小的读缓冲区
+        StreamReader *stream_reader = create_stream_reader(input_file);
+        if (!stream_reader || !process_stream(text_processor, stream_reader))
+        {
+            printf("文件读取失败\n");
+            destroy_stream_reader(stream_reader);
+            destroy_text_processor(text_processor);
+            return 1;
+        }
+        destroy_stream_reader(stream_reader);
+        printf("成功读取: %s（流式）\n", input_file);
+        print_statistics(text_processor);
+
+        DataSaver *data_saver = create_data_saver(output_file);
+        save_statistics(data_saver, text_processor);
+        int status = text_processor_valid(text_processor) ? 0 : 2;
+        destroy_text_processor(text_processor);
+        destroy_data_saver(data_saver);
+        return status;
+    }
+
+    // 1. 文件读取职责
+    FileReader *file_reader = create_file_reader();
+    if (!read_file(file_reader, input_file))
+    {
+        printf("文件读取失败\n");
         destroy_file_reader(file_reader);
+        destroy_text_processor(text_processor);
         return 1;
     }
 
     printf("成功读取文件: %s\n", input_file);
-    printf("文件内容:\n%s\n", file_reader->content);
+    if (file_reader->length <= SPP_PREVIEW_MAX)
+        printf("文件内容:\n%.*s\n", (int)file_reader->length, file_reader->content);
+    else
+        printf("文件内容（前 %d 字节，共 %zu 字节）:\n%.*s\n...\n", SPP_PREVIEW_MAX, file_reader->length,
+               SPP_PREVIEW_MAX, file_reader->content);
 
     // 2. 文本处理职责
-    TextProcessor *text_processor = create_text_processor();
-    process_text(text_processor, file_reader->content);
+#ifndef _WIN32
+    if (cache_file)
+        process_text_cached(text_processor, input_file, file_reader, threads, cache_file);
+    else
+#endif
+        process_text_parallel(text_processor, file_reader->content, file_reader->length, threads);
     print_statistics(text_processor);
 
     // 3. 数据保存职责
@@ -197,9 +2244,10 @@ int main()
     save_statistics(data_saver, text_processor);
 
     // 清理资源
+    int status = text_processor_valid(text_processor) ? 0 : 2;
     destroy_file_reader(file_reader);
     destroy_text_processor(text_processor);
     destroy_data_saver(data_saver);
 
-    return 0;
+    return status;
 }
\ No newline at end of file
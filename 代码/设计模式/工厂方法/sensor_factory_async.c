@@ -1,26 +1,105 @@
 /* sensor_factory_async.c
    Factory Method + object pool + IRQ-style async callbacks (no malloc).
-   Compile: gcc -std=c11 -O2 sensor_factory_async.c -o sensor_factory_async
+   ISR -> 主循环之间使用 C11 atomics 实现的无锁多生产者环形队列。
+   按传感器周期/相位采样由分层时间轮调度，主循环睡到下一个到期时间。
+   回调可由按传感器分片的工作线程池执行（同一传感器的事件保持顺序）。
+   经过 process_event_queue() 的事件可记录到 mmap 环形文件，离线按原速/加速回放。
+   Compile: gcc -std=c11 -O2 -pthread sensor_factory_async.c -o sensor_factory_async
+   Bench:   gcc -std=c11 -O2 -pthread -DSENSOR_FACTORY_BENCH sensor_factory_async.c -o sensor_bench
 */
 
+#define _POSIX_C_SOURCE 200809L /* clock_gettime / clock_nanosleep */
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
-#include <unistd.h> /* usleep for demo */
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #ifdef _WIN32
 #include <windows.h>
-#define usleep(us) Sleep((us) / 1000)
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 /* ---------- 抽象与回调类型 ---------- */
 
 typedef struct Sensor Sensor;
 
+/* 传感器句柄：| class:2 | generation:10 | index:20 |
+   generation 在 destroy 时递增，过期句柄/指针可以 O(1) 识别。0 永远无效。 */
+typedef uint32_t SensorHandle;
+
+#define SENSOR_HANDLE_INVALID 0u
+#define SENSOR_HANDLE_INDEX_BITS 20
+#define SENSOR_HANDLE_GEN_BITS 10
+#define SENSOR_HANDLE_INDEX_MASK ((1u << SENSOR_HANDLE_INDEX_BITS) - 1)
+#define SENSOR_HANDLE_GEN_MASK ((1u << SENSOR_HANDLE_GEN_BITS) - 1)
+#define SENSOR_HANDLE_MAKE(cls, gen, idx) \
+    (((uint32_t)(cls) << (SENSOR_HANDLE_INDEX_BITS + SENSOR_HANDLE_GEN_BITS)) | ((uint32_t)(gen) << SENSOR_HANDLE_INDEX_BITS) | (uint32_t)(idx))
+#define SENSOR_HANDLE_CLASS(h) ((h) >> (SENSOR_HANDLE_INDEX_BITS + SENSOR_HANDLE_GEN_BITS))
+#define SENSOR_HANDLE_GEN(h) (((h) >> SENSOR_HANDLE_INDEX_BITS) & SENSOR_HANDLE_GEN_MASK)
+#define SENSOR_HANDLE_INDEX(h) ((h) & SENSOR_HANDLE_INDEX_MASK)
+
 /* 回调签名：当异步读取完成后调用（在“线程/主循环”上下文执行） */
 typedef void (*sensor_callback_t)(Sensor *s, float value, void *ctx);
 
+/* 批量回调签名：一次交付同一传感器在本批次中的全部样本（按到达顺序） */
+typedef void (*sensor_batch_callback_t)(Sensor *s, const float *values, size_t count, void *ctx);
+
+/* 窗口聚合的一次输出：窗口内样本的最小/最大/均值/总体方差 */
+typedef struct
+{
+    uint64_t count;
+    float min;
+    float max;
+    double mean;
+    double variance;
+    uint64_t start_ns; /* 窗口内最早/最晚样本的推入时刻 */
+    uint64_t end_ns;
+} SensorWindowSummary;
+
+/* 窗口回调签名：每个窗口（滑动时每次滑动）调用一次 */
+typedef void (*sensor_window_callback_t)(Sensor *s, const SensorWindowSummary *summary, void *ctx);
+
+typedef struct SensorWindow SensorWindow;
+
+/* 时间轮节点（侵入式双向链表），嵌入在 Sensor 中 */
+typedef struct TimerNode
+{
+    struct TimerNode *next;
+    struct TimerNode **pprev; /* NULL 表示未挂在轮上 */
+    uint64_t expires;         /* 到期 tick */
+    uint32_t period;          /* 周期（tick），0 = 未调度 */
+    uint16_t slot;            /* 所在槽：level * 64 + idx */
+} TimerNode;
+
+/* 事件优先级：每级一条独立的事件环（lane），数值越小越先处理 */
+typedef enum
+{
+    SENSOR_PRIORITY_HIGH = 0,
+    SENSOR_PRIORITY_NORMAL,
+    SENSOR_PRIORITY_LOW,
+    SENSOR_PRIORITY_COUNT
+} SensorPriority;
+
+/* 每传感器事件计数（多生产者并发累加，relaxed 原子即可） */
+typedef struct
+{
+    _Atomic uint64_t pushes;    /* 成功推入事件环 */
+    _Atomic uint64_t drops;     /* 事件环满被丢弃 */
+    _Atomic uint64_t delivered; /* 已交给回调 */
+    _Atomic uint64_t conflated; /* 合并模式下被更新值覆盖 */
+} SensorCounters;
+
 typedef struct
 {
     void (*init)(Sensor *self);
@@ -32,32 +111,102 @@ typedef struct
 struct Sensor
 {
     const SensorVTable *vptr;
-    int id; /* 池索引 */
+    uint8_t kind; /* 类型标签：编译期已知类型为其 SensorClass，SENSOR_KIND_DYNAMIC 只走 vptr */
+    SensorHandle id; /* 池句柄（含尺寸类、代数、槽索引） */
     /* 异步支持 */
     sensor_callback_t cb;
+    sensor_batch_callback_t batch_cb; /* 非 NULL 时优先于 cb */
+    SensorWindow *window;             /* 非 NULL 时先聚合，按窗口回调（调用方提供存储） */
     void *cb_ctx;
     bool async_enabled;
+    /* 周期采样调度 */
+    TimerNode sample_timer;
+    /* 统计 */
+    SensorCounters counters;
+    /* 生产者与分发线程都会读，运行中也可以改：用 relaxed 原子，切换前已入队的事件不受影响 */
+    _Atomic uint8_t priority; /* SensorPriority，决定推入哪条 lane */
+    /* 合并（last-value）模式：每传感器一个待处理槽，新值覆盖旧值 */
+    _Atomic bool conflating;
+    _Atomic uint64_t conflated_value; /* bit32 = 有效，bit40..47 = 推入时的 lane，低 32 位 = float 位模式 */
+    _Atomic uint64_t conflated_ts;
 };
 
+/* ---------- 尺寸类与 SoA 采样列 ---------- */
+
+/* 每种传感器类型一个尺寸类（slab）。采样相关的热数据（原始值、校准偏移、
+   换算除数）不放在对象里，而是按槽索引放在该类的连续数组中（struct-of-arrays），
+   这样 sensor_read_all() 可以一次向量化地换算整个类型的所有传感器。 */
+
+/* 编译期已知的传感器类型表（X-macro）：X(类名, 结构体, 函数前缀, 工厂名, raw 是否有符号)。
+   新增类型在这里加一行并实现 <前缀>_init/_read/_name/_deinit 即可，
+   尺寸类枚举、对象尺寸表、默认池存储、vtable、sensor_read() 里的 switch、
+   sensor_read_all() 的符号选择以及 create_<工厂名>_sensor() 都由它展开。 */
+#define SENSOR_TYPE_LIST(X)                      \
+    X(TEMP, TempSensor, temp, temp, true)        \
+    X(PRESSURE, PressureSensor, pres, pressure, false)
+
+#define SENSOR_CLASS_ENUM(cls, type, prefix, name, raw_signed) SENSOR_CLASS_##cls,
+typedef enum
+{
+    SENSOR_TYPE_LIST(SENSOR_CLASS_ENUM)
+    SENSOR_CLASS_COUNT
+} SensorClass;
+#undef SENSOR_CLASS_ENUM
+
+#define SENSOR_KIND_DYNAMIC 0xFFu /* 运行时注册的类型：不在上表中，经 vptr 间接调用 */
+
+_Static_assert(SENSOR_CLASS_COUNT <= (1u << (32 - SENSOR_HANDLE_INDEX_BITS - SENSOR_HANDLE_GEN_BITS)),
+               "sensor classes must fit the handle class field");
+
+typedef struct
+{
+    uint8_t *objects;     /* capacity * stride 字节 */
+    _Atomic uint64_t *dirty; /* 合并模式：有待处理值的槽位图 */
+    atomic_bool dirty_any;   /* 位图非空的提示，消费者可跳过整类扫描 */
+    float *scale;         /* SoA：换算除数 */
+    uint32_t *next_free;  /* 空闲链表 */
+    uint16_t *generation; /* 每槽代数，从 1 开始 */
+    uint16_t *raw;        /* SoA：原始采样（TEMP 类按 int16_t 解释） */
+    int16_t *offset;      /* SoA：校准偏移 */
+    size_t stride;
+    uint32_t capacity;
+    uint32_t free_head;
+    uint32_t live;
+    uint32_t high_water; /* 曾经分配过的最大槽索引 + 1 */
+} SizeClassPool;
+
+static SizeClassPool pools[SENSOR_CLASS_COUNT];
+
+#define SENSOR_SLOT(s) SENSOR_HANDLE_INDEX((s)->id)
+
 /* ---------- 具体传感器：温度 ---------- */
 
+/* 采样状态（raw / calibration_offset）在 SoA 列中，见 temp_sensor_raw() */
 typedef struct
 {
     Sensor base;
-    int16_t raw;
-    int16_t calibration_offset;
 } TempSensor;
 
+int16_t *temp_sensor_raw(Sensor *s)
+{
+    return (int16_t *)&pools[SENSOR_CLASS_TEMP].raw[SENSOR_SLOT(s)];
+}
+int16_t *temp_sensor_calibration(Sensor *s)
+{
+    return &pools[SENSOR_CLASS_TEMP].offset[SENSOR_SLOT(s)];
+}
+
 static void temp_init(Sensor *s)
 {
-    TempSensor *t = (TempSensor *)s;
-    t->raw = 250;
-    t->calibration_offset = 0;
+    *temp_sensor_raw(s) = 250;
+    *temp_sensor_calibration(s) = 0;
+    pools[SENSOR_CLASS_TEMP].scale[SENSOR_SLOT(s)] = 10.0f;
 }
 static float temp_read(Sensor *s)
 {
-    TempSensor *t = (TempSensor *)s;
-    return (t->raw + t->calibration_offset) / 10.0f;
+    const SizeClassPool *pool = &pools[SENSOR_CLASS_TEMP];
+    uint32_t i = SENSOR_SLOT(s);
+    return ((int16_t)pool->raw[i] + pool->offset[i]) / pool->scale[i];
 }
 static const char *temp_name(Sensor *s)
 {
@@ -66,31 +215,34 @@ static const char *temp_name(Sensor *s)
 }
 static void temp_deinit(Sensor *s) { (void)s; }
 
-static const SensorVTable temp_vtable = {
-    .init = temp_init,
-    .read = temp_read,
-    .type_name = temp_name,
-    .deinit = temp_deinit};
-
 /* ---------- 具体传感器：压力 ---------- */
 
+/* pressure_raw 在 SoA 列中，见 pressure_sensor_raw() */
 typedef struct
 {
     Sensor base;
-    uint16_t pressure_raw;
     uint8_t range_kpa;
 } PressureSensor;
 
+uint16_t *pressure_sensor_raw(Sensor *s)
+{
+    return &pools[SENSOR_CLASS_PRESSURE].raw[SENSOR_SLOT(s)];
+}
+
 static void pres_init(Sensor *s)
 {
     PressureSensor *p = (PressureSensor *)s;
-    p->pressure_raw = 1013;
+    const SizeClassPool *pool = &pools[SENSOR_CLASS_PRESSURE];
+    *pressure_sensor_raw(s) = 1013;
+    pool->offset[SENSOR_SLOT(s)] = 0;
+    pool->scale[SENSOR_SLOT(s)] = 10.0f;
     p->range_kpa = 100;
 }
 static float pres_read(Sensor *s)
 {
-    PressureSensor *p = (PressureSensor *)s;
-    return p->pressure_raw / 10.0f;
+    const SizeClassPool *pool = &pools[SENSOR_CLASS_PRESSURE];
+    uint32_t i = SENSOR_SLOT(s);
+    return (pool->raw[i] + pool->offset[i]) / pool->scale[i];
 }
 static const char *pres_name(Sensor *s)
 {
@@ -99,234 +251,2128 @@ static const char *pres_name(Sensor *s)
 }
 static void pres_deinit(Sensor *s) { (void)s; }
 
-static const SensorVTable pres_vtable = {
-    .init = pres_init,
-    .read = pres_read,
-    .type_name = pres_name,
-    .deinit = pres_deinit};
+/* ---------- 类型分发：已知类型走 switch（可内联），其余走 vtable ---------- */
+
+#define SENSOR_VTABLE_DEF(cls, type, prefix, name, raw_signed) \
+    static const SensorVTable prefix##_vtable = {  \
+        .init = prefix##_init,                     \
+        .read = prefix##_read,                     \
+        .type_name = prefix##_name,                \
+        .deinit = prefix##_deinit};
+SENSOR_TYPE_LIST(SENSOR_VTABLE_DEF)
+#undef SENSOR_VTABLE_DEF
+
+/* 热路径读取：按类型标签 switch 直接调用具体实现，编译器可以把 temp_read/pres_read
+   内联进 hardware_trigger_sensor 和批量循环；运行时注册的类型落到 vptr。 */
+static inline float sensor_read(Sensor *s)
+{
+    switch (s->kind)
+    {
+#define SENSOR_READ_CASE(cls, type, prefix, name, raw_signed) \
+    case SENSOR_CLASS_##cls:                \
+        return prefix##_read(s);
+        SENSOR_TYPE_LIST(SENSOR_READ_CASE)
+#undef SENSOR_READ_CASE
+    default:
+        return s->vptr->read(s);
+    }
+}
+
+static inline const char *sensor_type_name(Sensor *s)
+{
+    switch (s->kind)
+    {
+#define SENSOR_NAME_CASE(cls, type, prefix, name, raw_signed) \
+    case SENSOR_CLASS_##cls:                \
+        return prefix##_name(s);
+        SENSOR_TYPE_LIST(SENSOR_NAME_CASE)
+#undef SENSOR_NAME_CASE
+    default:
+        return s->vptr->type_name(s);
+    }
+}
+
+/* 运行时注册的类型（测试桩、插件等）：复用某个尺寸类的槽，换上自己的 vtable。
+   之后该传感器的所有调用都经 vptr 间接分发。 */
+void sensor_bind_vtable(Sensor *s, const SensorVTable *vt)
+{
+    if (!s || !vt)
+        return;
+    s->vptr = vt;
+    s->kind = SENSOR_KIND_DYNAMIC;
+}
 
 /* ---------- 对象池（无 malloc） ---------- */
 
-#define POOL_SIZE 6
-#define MAX_OBJ_SIZE ((sizeof(PressureSensor) > sizeof(TempSensor)) ? sizeof(PressureSensor) : sizeof(TempSensor))
+/* 对象槽宽等于该类型的实际大小。
+   空闲槽用下标链表串起来（next_free 与对象分离存放），alloc/free 都是 O(1)，
+   释放时不清零对象内存，只递增代数，因此过期指针上的 id 仍可用于检查。
+   容量可以在运行时通过 sensor_pool_configure() 用调用方提供的内存设置；
+   未配置时使用下面的静态默认存储。创建/销毁只应在单一线程中进行。 */
+
+#define POOL_NIL 0xFFFFFFFFu
+#define POOL_MAX_CAPACITY SENSOR_HANDLE_INDEX_MASK
+#define POOL_DEFAULT_CAPACITY 8
+
+#define SENSOR_CLASS_SIZE(cls, type, prefix, name, raw_signed) [SENSOR_CLASS_##cls] = sizeof(type),
+static const size_t sensor_class_size[SENSOR_CLASS_COUNT] = {SENSOR_TYPE_LIST(SENSOR_CLASS_SIZE)};
+#undef SENSOR_CLASS_SIZE
+
+/* raw 列按 int16_t 还是 uint16_t 解释（sensor_read_all 的换算核要区分） */
+#define SENSOR_CLASS_SIGNED(cls, type, prefix, name, raw_signed) [SENSOR_CLASS_##cls] = raw_signed,
+static const bool sensor_class_raw_signed[SENSOR_CLASS_COUNT] = {SENSOR_TYPE_LIST(SENSOR_CLASS_SIGNED)};
+#undef SENSOR_CLASS_SIGNED
 
-static uint8_t pool[POOL_SIZE][MAX_OBJ_SIZE];
-static bool pool_used[POOL_SIZE] = {0};
+/* 每槽占用：对象 + scale + next_free + generation + raw + offset，另加每 64 槽一个脏位字 */
+#define POOL_SLOT_OVERHEAD (sizeof(float) + sizeof(uint32_t) + 3 * sizeof(uint16_t))
+#define POOL_DIRTY_WORDS(cap) (((size_t)(cap) + 63) / 64)
+#define POOL_STORAGE_BYTES(obj_size, cap) \
+    ((size_t)(cap) * ((obj_size) + POOL_SLOT_OVERHEAD) + POOL_DIRTY_WORDS(cap) * sizeof(uint64_t))
 
-static int pool_alloc_slot(void)
+/* 给定容量所需的存储字节数（存储须按 max_align_t 对齐） */
+size_t sensor_pool_storage_bytes(SensorClass cls, uint32_t capacity)
 {
-    for (int i = 0; i < POOL_SIZE; ++i)
+    return POOL_STORAGE_BYTES(sensor_class_size[cls], capacity);
+}
+
+/* 用调用方提供的内存设置某尺寸类的容量；该类中已有传感器时失败 */
+bool sensor_pool_configure(SensorClass cls, void *storage, size_t storage_bytes)
+{
+    SizeClassPool *pool = &pools[cls];
+    if (pool->live > 0 || !storage)
+        return false;
+    size_t per_slot = sensor_class_size[cls] + POOL_SLOT_OVERHEAD;
+    size_t capacity = storage_bytes / per_slot;
+    while (capacity > 0 && POOL_STORAGE_BYTES(sensor_class_size[cls], capacity) > storage_bytes)
+        --capacity;
+    if (capacity == 0)
+        return false;
+    if (capacity > POOL_MAX_CAPACITY)
+        capacity = POOL_MAX_CAPACITY;
+
+    pool->stride = sensor_class_size[cls];
+    pool->capacity = (uint32_t)capacity;
+    pool->objects = (uint8_t *)storage;
+    pool->dirty = (_Atomic uint64_t *)(void *)(pool->objects + capacity * pool->stride);
+    pool->scale = (float *)(void *)(pool->dirty + POOL_DIRTY_WORDS(capacity));
+    pool->next_free = (uint32_t *)(void *)(pool->scale + capacity);
+    pool->generation = (uint16_t *)(void *)(pool->next_free + capacity);
+    pool->raw = pool->generation + capacity;
+    pool->offset = (int16_t *)(pool->raw + capacity);
+    for (uint32_t i = 0; i < pool->capacity; ++i)
     {
-        if (!pool_used[i])
-        {
-            pool_used[i] = true;
-            return i;
-        }
+        pool->next_free[i] = (i + 1 < pool->capacity) ? i + 1 : POOL_NIL;
+        pool->generation[i] = 1;
+        pool->raw[i] = 0;
+        pool->offset[i] = 0;
+        pool->scale[i] = 1.0f;
     }
-    return -1;
+    for (size_t w = 0; w < POOL_DIRTY_WORDS(capacity); ++w)
+        atomic_store_explicit(&pool->dirty[w], 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->dirty_any, false, memory_order_relaxed);
+    pool->free_head = 0;
+    pool->live = 0;
+    pool->high_water = 0;
+    return true;
 }
-static void pool_free_slot(int idx)
+
+/* 每个尺寸类一块静态默认存储 */
+#define SENSOR_DEFAULT_STORAGE(cls, type, prefix, name, raw_signed) \
+    static _Alignas(max_align_t) uint8_t prefix##_default_storage[POOL_STORAGE_BYTES(sizeof(type), POOL_DEFAULT_CAPACITY)];
+SENSOR_TYPE_LIST(SENSOR_DEFAULT_STORAGE)
+#undef SENSOR_DEFAULT_STORAGE
+
+static void sensor_pool_ensure_default(SensorClass cls)
 {
-    if (idx >= 0 && idx < POOL_SIZE)
+    if (pools[cls].capacity != 0)
+        return;
+    switch (cls)
     {
-        pool_used[idx] = false;
-        memset(pool[idx], 0, MAX_OBJ_SIZE);
+#define SENSOR_DEFAULT_CASE(cls, type, prefix, name, raw_signed)                                      \
+    case SENSOR_CLASS_##cls:                                                                          \
+        sensor_pool_configure(SENSOR_CLASS_##cls, prefix##_default_storage, sizeof(prefix##_default_storage)); \
+        break;
+        SENSOR_TYPE_LIST(SENSOR_DEFAULT_CASE)
+#undef SENSOR_DEFAULT_CASE
+    default:
+        break;
     }
 }
 
+/* O(1) 分配：弹出空闲链表头，返回对象地址，并输出新句柄 */
+static void *pool_alloc_slot(SensorClass cls, SensorHandle *out_handle)
+{
+    sensor_pool_ensure_default(cls);
+    SizeClassPool *pool = &pools[cls];
+    uint32_t idx = pool->free_head;
+    if (idx == POOL_NIL)
+        return NULL;
+    pool->free_head = pool->next_free[idx];
+    pool->next_free[idx] = POOL_NIL;
+    pool->live++;
+    if (idx >= pool->high_water)
+        pool->high_water = idx + 1;
+    *out_handle = SENSOR_HANDLE_MAKE(cls, pool->generation[idx], idx);
+    return pool->objects + (size_t)idx * pool->stride;
+}
+
+/* 句柄 -> 对象；句柄过期（已销毁/被复用）时返回 NULL */
+Sensor *sensor_from_handle(SensorHandle h)
+{
+    uint32_t cls = SENSOR_HANDLE_CLASS(h);
+    uint32_t idx = SENSOR_HANDLE_INDEX(h);
+    if (cls >= SENSOR_CLASS_COUNT)
+        return NULL;
+    const SizeClassPool *pool = &pools[cls];
+    if (idx >= pool->capacity || pool->generation[idx] != SENSOR_HANDLE_GEN(h))
+        return NULL;
+    return (Sensor *)(void *)(pool->objects + (size_t)idx * pool->stride);
+}
+
+/* 检查指针是否仍指向一个存活的传感器（捕获 destroy 之后的误用） */
+bool sensor_is_live(const Sensor *s)
+{
+    return s && s->id != SENSOR_HANDLE_INVALID && sensor_from_handle(s->id) == s;
+}
+
+/* O(1) 释放：递增代数使旧句柄失效，并压回空闲链表（不清零对象） */
+static void pool_free_slot(SensorHandle h)
+{
+    SizeClassPool *pool = &pools[SENSOR_HANDLE_CLASS(h)];
+    uint32_t idx = SENSOR_HANDLE_INDEX(h);
+    uint16_t gen = (uint16_t)((pool->generation[idx] + 1) & SENSOR_HANDLE_GEN_MASK);
+    pool->generation[idx] = gen ? gen : 1;
+    pool->next_free[idx] = pool->free_head;
+    pool->free_head = idx;
+    pool->live--;
+}
+
 /* ---------- 工厂函数 ---------- */
 
-Sensor *create_temp_sensor(int *out_id)
+/* 公共部分：取槽、清零、填基类字段，再调用该类型的 init */
+static Sensor *sensor_construct(SensorClass cls, const SensorVTable *vt, SensorHandle *out_id)
 {
-    int slot = pool_alloc_slot();
-    if (slot < 0)
+    SensorHandle h;
+    Sensor *s = (Sensor *)pool_alloc_slot(cls, &h);
+    if (!s)
         return NULL;
-    TempSensor *t = (TempSensor *)(void *)pool[slot];
-    memset(t, 0, sizeof(TempSensor));
-    t->base.vptr = &temp_vtable;
-    t->base.id = slot;
-    t->base.cb = NULL;
-    t->base.cb_ctx = NULL;
-    t->base.async_enabled = false;
-    t->raw = 0;
-    t->calibration_offset = 0;
-    t->base.vptr->init((Sensor *)t);
+    memset(s, 0, sensor_class_size[cls]);
+    s->vptr = vt;
+    s->kind = (uint8_t)cls;
+    s->id = h;
+    s->cb = NULL;
+    s->batch_cb = NULL;
+    s->window = NULL;
+    s->cb_ctx = NULL;
+    s->async_enabled = false;
+    atomic_init(&s->priority, SENSOR_PRIORITY_NORMAL);
+    s->vptr->init(s);
     if (out_id)
-        *out_id = slot;
-    return (Sensor *)t;
+        *out_id = h;
+    return s;
 }
 
-Sensor *create_pressure_sensor(int *out_id)
+/* 每种类型一个工厂：create_temp_sensor()、create_pressure_sensor() …… */
+#define SENSOR_FACTORY_DEF(cls, type, prefix, name, raw_signed)         \
+    Sensor *create_##name##_sensor(SensorHandle *out_id)                \
+    {                                                                   \
+        return sensor_construct(SENSOR_CLASS_##cls, &prefix##_vtable, out_id); \
+    }
+SENSOR_TYPE_LIST(SENSOR_FACTORY_DEF)
+#undef SENSOR_FACTORY_DEF
+
+/* 按尺寸类创建：调用方只知道类编号时用（如按类型轮流创建） */
+Sensor *create_sensor(SensorClass cls, SensorHandle *out_id)
 {
-    int slot = pool_alloc_slot();
-    if (slot < 0)
+    switch (cls)
+    {
+#define SENSOR_CREATE_CASE(cls, type, prefix, name, raw_signed) \
+    case SENSOR_CLASS_##cls:                                    \
+        return create_##name##_sensor(out_id);
+        SENSOR_TYPE_LIST(SENSOR_CREATE_CASE)
+#undef SENSOR_CREATE_CASE
+    default:
         return NULL;
-    PressureSensor *p = (PressureSensor *)(void *)pool[slot];
-    memset(p, 0, sizeof(PressureSensor));
-    p->base.vptr = &pres_vtable;
-    p->base.id = slot;
-    p->base.cb = NULL;
-    p->base.cb_ctx = NULL;
-    p->base.async_enabled = false;
-    p->pressure_raw = 0;
-    p->range_kpa = 0;
-    p->base.vptr->init((Sensor *)p);
-    if (out_id)
-        *out_id = slot;
-    return (Sensor *)p;
+    }
 }
 
+void sensor_cancel_sampling(Sensor *s);
+
 void destroy_sensor(Sensor *s)
 {
-    if (!s)
-        return;
-    int slot = s->id;
+    if (!sensor_is_live(s))
+        return; /* NULL、重复销毁或过期指针 */
+    SensorHandle h = s->id;
+    sensor_cancel_sampling(s);
     if (s->vptr && s->vptr->deinit)
         s->vptr->deinit(s);
-    pool_free_slot(slot);
+    s->async_enabled = false;
+    pool_free_slot(h);
 }
 
-/* ---------- 事件队列（ISR 推入，主循环处理） ---------- */
+/* ---------- 批量采样：SoA 向量化换算 ---------- */
 
-#define EVENT_QUEUE_DEPTH 32
+/* value[i] = (raw[i] + offset[i]) / scale[i]，与 temp_read / pres_read 逐位一致
+   （同样是先做整数加法再做 IEEE 除法）。x86 上按运行时检测选择 AVX2 / SSE2，
+   其它平台走标量版本。raw 按 is_signed 做符号/零扩展。 */
 
-typedef struct
+static void convert_scalar(const uint16_t *raw, const int16_t *off, const float *scale,
+                           float *out, size_t n, bool is_signed)
 {
-    Sensor *sensor;
-    float value;
-} SensorEvent;
+    for (size_t i = 0; i < n; ++i)
+    {
+        int32_t r = is_signed ? (int32_t)(int16_t)raw[i] : (int32_t)raw[i];
+        out[i] = (float)(r + off[i]) / scale[i];
+    }
+}
 
-static SensorEvent event_queue[EVENT_QUEUE_DEPTH];
-static volatile int eq_head = 0; /* next to pop */
-static volatile int eq_tail = 0; /* next to push */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SENSOR_HAVE_X86_SIMD 1
 
-/* 在 ISR 上下文调用：尽量小，返回是否推入成功（false => 丢弃事件） */
-static bool isr_push_event(Sensor *s, float val)
+__attribute__((target("sse2"))) static void convert_sse2(const uint16_t *raw, const int16_t *off, const float *scale,
+                                                         float *out, size_t n, bool is_signed)
 {
-    int next = (eq_tail + 1) % EVENT_QUEUE_DEPTH;
-    if (next == eq_head)
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
     {
-        /* 队列满 — 在 ISR 中不能阻塞，丢弃事件或计统计 */
-        return false;
+        __m128i r = _mm_loadu_si128((const __m128i *)(const void *)(raw + i));
+        __m128i o = _mm_loadu_si128((const __m128i *)(const void *)(off + i));
+        /* 16 -> 32 位扩展：有符号用“自身交错再算术右移”，无符号与 0 交错 */
+        __m128i r_lo = is_signed ? _mm_srai_epi32(_mm_unpacklo_epi16(r, r), 16) : _mm_unpacklo_epi16(r, zero);
+        __m128i r_hi = is_signed ? _mm_srai_epi32(_mm_unpackhi_epi16(r, r), 16) : _mm_unpackhi_epi16(r, zero);
+        __m128i o_lo = _mm_srai_epi32(_mm_unpacklo_epi16(o, o), 16);
+        __m128i o_hi = _mm_srai_epi32(_mm_unpackhi_epi16(o, o), 16);
+        __m128 v_lo = _mm_cvtepi32_ps(_mm_add_epi32(r_lo, o_lo));
+        __m128 v_hi = _mm_cvtepi32_ps(_mm_add_epi32(r_hi, o_hi));
+        _mm_storeu_ps(out + i, _mm_div_ps(v_lo, _mm_loadu_ps(scale + i)));
+        _mm_storeu_ps(out + i + 4, _mm_div_ps(v_hi, _mm_loadu_ps(scale + i + 4)));
     }
-    event_queue[eq_tail].sensor = s;
-    event_queue[eq_tail].value = val;
-    /* 简单的内存屏障（在裸机上可能为简短指令）*/
-    __sync_synchronize();
-    eq_tail = next;
-    return true;
+    convert_scalar(raw + i, off + i, scale + i, out + i, n - i, is_signed);
 }
 
-/* 主循环调用，处理并调用用户回调（非 ISR） */
-static void process_event_queue(void)
+__attribute__((target("avx2"))) static void convert_avx2(const uint16_t *raw, const int16_t *off, const float *scale,
+                                                         float *out, size_t n, bool is_signed)
 {
-    while (eq_head != eq_tail)
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
     {
-        SensorEvent ev = event_queue[eq_head];
-        eq_head = (eq_head + 1) % EVENT_QUEUE_DEPTH;
-        /* 调用注册的回调（如果有） */
-        if (ev.sensor && ev.sensor->cb && ev.sensor->async_enabled)
-        {
-            ev.sensor->cb(ev.sensor, ev.value, ev.sensor->cb_ctx);
-        }
+        __m128i r = _mm_loadu_si128((const __m128i *)(const void *)(raw + i));
+        __m128i o = _mm_loadu_si128((const __m128i *)(const void *)(off + i));
+        __m256i r32 = is_signed ? _mm256_cvtepi16_epi32(r) : _mm256_cvtepu16_epi32(r);
+        __m256 v = _mm256_cvtepi32_ps(_mm256_add_epi32(r32, _mm256_cvtepi16_epi32(o)));
+        _mm256_storeu_ps(out + i, _mm256_div_ps(v, _mm256_loadu_ps(scale + i)));
     }
+    convert_scalar(raw + i, off + i, scale + i, out + i, n - i, is_signed);
 }
+#endif
 
-/* ---------- 硬件中断模拟：在 ISR 中读取硬件并 push_event ---------- */
+typedef void (*convert_fn_t)(const uint16_t *, const int16_t *, const float *, float *, size_t, bool);
 
-/* 真实系统中，这个函数会在 ISR 中被调用（或被 ISR 标记/触发）。
-   对于示例，我们在 main 的循环中调用它来模拟中断触发。
-*/
-void hardware_trigger_sensor(Sensor *s)
+static convert_fn_t select_convert_kernel(void)
 {
-    if (!s)
-        return;
-    /* ISR: 读取原始数据（通过 vptr->read），然后 push 到队列。
-       注意：在真实 ISR 中，可能需要读取硬件寄存器/ADC 而不是调用复杂函数。
-    */
-    float val = s->vptr->read(s); /* 同步转换，假设快 */
-    bool pushed = isr_push_event(s, val);
-    (void)pushed; /* 可以统计丢弃率 */
+#ifdef SENSOR_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return convert_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return convert_sse2;
+#endif
+    return convert_scalar;
 }
 
-/* ---------- 异步 API（供客户端使用） ---------- */
+/* 一次换算某类型全部传感器，out[i] 对应槽索引 i（空闲槽的值无意义）。
+   返回写入的个数（该类的 high_water，且不超过 max）。 */
+size_t sensor_read_all(SensorClass cls, float *out, size_t max)
+{
+    static convert_fn_t kernel = NULL;
+    if (!kernel)
+        kernel = select_convert_kernel();
+    const SizeClassPool *pool = &pools[cls];
+    size_t n = pool->high_water < max ? pool->high_water : max;
+    kernel(pool->raw, pool->offset, pool->scale, out, n, sensor_class_raw_signed[cls]);
+    return n;
+}
 
-/* 启动异步采样（注册回调） */
-void sensor_start_async(Sensor *s, sensor_callback_t cb, void *ctx)
+/* ---------- 统计：计数与延迟直方图 ---------- */
+
+static uint64_t monotonic_ns(void)
 {
-    if (!s)
-        return;
-    s->cb = cb;
-    s->cb_ctx = ctx;
-    s->async_enabled = true;
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64() * 1000000ull;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
 }
 
-/* 停止异步采样 */
-void sensor_stop_async(Sensor *s)
+/* HDR 风格对数分桶：每个 2 的幂区间再分 8 个子桶（相对误差约 12.5%），
+   覆盖 0 ~ 2^64 ns。桶是原子计数（每个优先级一组），记录与快照都不需要停止生产者。 */
+#define LAT_SUB_BITS 3
+#define LAT_SUB_COUNT (1u << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS) * LAT_SUB_COUNT + LAT_SUB_COUNT)
+
+static _Atomic uint64_t latency_hist[SENSOR_PRIORITY_COUNT][LAT_BUCKETS];
+
+/* 每条 lane 的推入/丢弃计数（lane 满时只丢该 lane 的事件） */
+static _Atomic uint64_t lane_pushes[SENSOR_PRIORITY_COUNT];
+static _Atomic uint64_t lane_drops[SENSOR_PRIORITY_COUNT];
+
+static unsigned latency_bucket(uint64_t v)
 {
-    if (!s)
-        return;
-    s->async_enabled = false;
-    s->cb = NULL;
-    s->cb_ctx = NULL;
+    unsigned msb = v ? 63u - (unsigned)__builtin_clzll(v) : 0;
+    unsigned shift = msb > LAT_SUB_BITS ? msb - LAT_SUB_BITS : 0;
+    return shift * LAT_SUB_COUNT + (unsigned)(v >> shift);
 }
 
-/* ---------- 客户端回调示例 ---------- */
+/* 桶内可能的最大值（与 HdrHistogram 的 highest equivalent value 相同） */
+static uint64_t latency_bucket_high(unsigned idx)
+{
+    if (idx < 2 * LAT_SUB_COUNT)
+        return idx;
+    unsigned shift = idx / LAT_SUB_COUNT - 1;
+    uint64_t sub = idx - shift * LAT_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
 
-static void my_sensor_cb(Sensor *s, float value, void *ctx)
+static void latency_record(unsigned prio, uint64_t ns)
 {
-    const char *tag = (const char *)ctx;
-    printf("[callback] slot=%d type=%s tag=%s value=%.2f\n", s->id, s->vptr->type_name(s), tag ? tag : "(null)", value);
+    atomic_fetch_add_explicit(&latency_hist[prio][latency_bucket(ns)], 1, memory_order_relaxed);
 }
 
-/* ---------- 测试主程序（模拟主循环 + 硬件触发） ---------- */
+typedef struct
+{
+    uint64_t pushes;
+    uint64_t drops;
+    uint64_t delivered;
+    uint64_t conflated;
+    uint64_t latency_count;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    uint64_t latency_buckets[LAT_BUCKETS]; /* 各优先级之和 */
+    struct
+    {
+        uint64_t pushes; /* 含合并模式的推入（按传感器当前优先级归入） */
+        uint64_t drops;
+        uint64_t p50_ns;
+        uint64_t p99_ns;
+        uint64_t p999_ns;
+    } lanes[SENSOR_PRIORITY_COUNT];
+} SensorStatsSnapshot;
 
-int main(void)
+static uint64_t latency_percentile(const uint64_t *buckets, uint64_t count, double q)
 {
-    /* 创建一些传感器 */
-    Sensor *t1 = create_temp_sensor(NULL);
-    Sensor *p1 = create_pressure_sensor(NULL);
-    Sensor *t2 = create_temp_sensor(NULL);
+    uint64_t rank = (uint64_t)(q * (double)count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LAT_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return latency_bucket_high(i);
+    }
+    return 0;
+}
+
+/* 读取单个传感器的计数（各字段分别原子读取，彼此之间不保证是同一瞬间） */
+void sensor_counters_read(const Sensor *s, uint64_t *pushes, uint64_t *drops, uint64_t *delivered)
+{
+    SensorCounters *c = (SensorCounters *)&s->counters;
+    *pushes = atomic_load_explicit(&c->pushes, memory_order_relaxed);
+    *drops = atomic_load_explicit(&c->drops, memory_order_relaxed);
+    *delivered = atomic_load_explicit(&c->delivered, memory_order_relaxed);
+}
 
-    if (!t1 || !p1 || !t2)
+/* 汇总所有存活传感器的计数与全局延迟直方图，生产者/回调可以继续运行 */
+void sensor_stats_snapshot(SensorStatsSnapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (int cls = 0; cls < SENSOR_CLASS_COUNT; ++cls)
     {
-        printf("create failed\n");
-        return 1;
+        const SizeClassPool *pool = &pools[cls];
+        for (uint32_t i = 0; i < pool->high_water; ++i)
+        {
+            const Sensor *s = (const Sensor *)(const void *)(pool->objects + (size_t)i * pool->stride);
+            if (!sensor_is_live(s))
+                continue;
+            uint64_t p, d, dl;
+            sensor_counters_read(s, &p, &d, &dl);
+            out->pushes += p;
+            out->drops += d;
+            out->delivered += dl;
+            out->conflated += atomic_load_explicit(&((Sensor *)s)->counters.conflated, memory_order_relaxed);
+        }
+    }
+    for (int prio = 0; prio < SENSOR_PRIORITY_COUNT; ++prio)
+    {
+        uint64_t buckets[LAT_BUCKETS];
+        uint64_t count = 0;
+        for (unsigned i = 0; i < LAT_BUCKETS; ++i)
+        {
+            buckets[i] = atomic_load_explicit(&latency_hist[prio][i], memory_order_relaxed);
+            count += buckets[i];
+            out->latency_buckets[i] += buckets[i];
+        }
+        out->lanes[prio].pushes = atomic_load_explicit(&lane_pushes[prio], memory_order_relaxed);
+        out->lanes[prio].drops = atomic_load_explicit(&lane_drops[prio], memory_order_relaxed);
+        out->lanes[prio].p50_ns = latency_percentile(buckets, count, 0.50);
+        out->lanes[prio].p99_ns = latency_percentile(buckets, count, 0.99);
+        out->lanes[prio].p999_ns = latency_percentile(buckets, count, 0.999);
+    }
+    for (unsigned i = 0; i < LAT_BUCKETS; ++i)
+    {
+        out->latency_count += out->latency_buckets[i];
+        if (out->latency_buckets[i])
+            out->max_ns = latency_bucket_high(i);
     }
+    out->p50_ns = latency_percentile(out->latency_buckets, out->latency_count, 0.50);
+    out->p99_ns = latency_percentile(out->latency_buckets, out->latency_count, 0.99);
+    out->p999_ns = latency_percentile(out->latency_buckets, out->latency_count, 0.999);
+}
 
-    /* 注册异步回调（开始异步模式） */
-    sensor_start_async(t1, my_sensor_cb, "T1");
-    sensor_start_async(p1, my_sensor_cb, "P1");
-    sensor_start_async(t2, my_sensor_cb, "T2");
+/* ---------- 事件队列（ISR 推入，主循环处理） ---------- */
+
+/* 无锁环形队列（C11 atomics）：
+   - 深度为 2 的幂，用掩码代替 % 取模；
+   - head / tail / reserved 各占一条 cache line，避免生产者与消费者伪共享；
+   - 每个槽带发布序号 seq，生产者写完数据后以 release 存入 seq，
+     消费者以 acquire 读取，替代原来的 __sync_synchronize() 全屏障；
+   - MPSC 模式：任意多个生产者（多个中断源/线程）并发推入，推入路径只有
+     固定次数的原子 RMW，没有 CAS 重试循环，因此对生产者是 wait-free 的；
+   - SPSC 模式：只有一个生产者时省掉 reserved 计数，开销最小。
+*/
+
+#ifndef EVENT_QUEUE_DEPTH
+#define EVENT_QUEUE_DEPTH 32 /* 必须为 2 的幂 */
+#endif
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_DEPTH - 1)
+#define CACHE_LINE_SIZE 64
+
+_Static_assert((EVENT_QUEUE_DEPTH & EVENT_QUEUE_MASK) == 0, "EVENT_QUEUE_DEPTH must be a power of two");
+
+/* 一次取出、分组、分发的事件数上限，固定而不随 EVENT_QUEUE_DEPTH 变化：
+   分组是 O(n^2) 的插入排序，批次数组和回调用的 values 暂存都放在栈上
+   （主循环、分发线程都会用到），队列调深时批次不跟着变大。 */
+#define DISPATCH_BATCH_MAX 64
+
+typedef struct
+{
+    Sensor *sensor;
+    SensorHandle handle; /* 推入时的句柄，分发前用于过期检查 */
+    float value;
+    uint64_t timestamp_ns; /* 推入时刻（单调时钟），用于 ISR -> 回调延迟统计 */
+    uint8_t lane;          /* 推入时所在的 lane：延迟按它归类，之后再改优先级也不影响 */
+} SensorEvent;
+
+typedef enum
+{
+    EVENT_RING_MPSC = 0, /* 默认（静态零初始化）即多生产者模式 */
+    EVENT_RING_SPSC
+} EventRingMode;
+
+typedef struct
+{
+    _Atomic uint32_t seq; /* == 票号 + 1 表示该槽已发布 */
+    SensorEvent ev;
+} EventSlot;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail;     /* 下一个待分配的票号（生产者） */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t reserved; /* MPSC：已占用但尚未被消费者释放的槽数 */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head;     /* 下一个待弹出的票号（消费者） */
+    EventRingMode mode;
+    _Alignas(CACHE_LINE_SIZE) EventSlot slots[EVENT_QUEUE_DEPTH];
+} EventRing;
+
+/* 每个优先级一条 lane；process_event_queue() 严格按优先级取，另有防饿死预算 */
+static EventRing event_lanes[SENSOR_PRIORITY_COUNT];
+
+/* 必须在没有生产者/消费者运行时调用 */
+static void event_ring_init(EventRing *r, EventRingMode mode)
+{
+    atomic_store_explicit(&r->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&r->reserved, 0, memory_order_relaxed);
+    atomic_store_explicit(&r->head, 0, memory_order_relaxed);
+    for (int i = 0; i < EVENT_QUEUE_DEPTH; ++i)
+        atomic_store_explicit(&r->slots[i].seq, 0, memory_order_relaxed);
+    r->mode = mode;
+}
+
+/* 初始化全部 lane，必须在没有生产者/消费者运行时调用 */
+static void event_queue_init(EventRingMode mode)
+{
+    for (int prio = 0; prio < SENSOR_PRIORITY_COUNT; ++prio)
+        event_ring_init(&event_lanes[prio], mode);
+}
 
-    /* 主循环：我们每次循环随机“硬件触发”若干传感器，然后处理队列 */
-    for (int loop = 0; loop < 20; ++loop)
+/* 生产者端：返回是否推入成功（false => 队列满，丢弃事件） */
+static bool event_ring_push(EventRing *r, const SensorEvent *ev)
+{
+    uint32_t ticket;
+    if (r->mode == EVENT_RING_SPSC)
     {
-        /* 模拟硬件更新一些内部原始值（演示） */
-        ((TempSensor *)t1)->raw += 1;                                    /* 温度慢慢上升 */
-        ((PressureSensor *)p1)->pressure_raw += (loop % 3 == 0) ? 1 : 0; /* 偶尔变化 */
-        ((TempSensor *)t2)->raw += (loop % 2 == 0) ? 2 : 0;
+        ticket = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (ticket - head >= EVENT_QUEUE_DEPTH)
+            return false;
+        atomic_store_explicit(&r->tail, ticket + 1, memory_order_relaxed);
+    }
+    else
+    {
+        /* 先预留容量：成功预留的生产者数量永远不超过深度，
+           所以随后拿到的票号对应的槽一定已被消费者释放。 */
+        uint32_t used = atomic_fetch_add_explicit(&r->reserved, 1, memory_order_acquire);
+        if (used >= EVENT_QUEUE_DEPTH)
+        {
+            atomic_fetch_sub_explicit(&r->reserved, 1, memory_order_relaxed);
+            return false;
+        }
+        ticket = atomic_fetch_add_explicit(&r->tail, 1, memory_order_relaxed);
+    }
+
+    EventSlot *slot = &r->slots[ticket & EVENT_QUEUE_MASK];
+    slot->ev = *ev;
+    atomic_store_explicit(&slot->seq, ticket + 1, memory_order_release);
+    return true;
+}
 
-        /* 模拟 ISR 触发 — 在真实环境这些会被定时器/外设中断调用 */
-        hardware_trigger_sensor(t1);
-        hardware_trigger_sensor(p1);
-        if (loop % 2 == 0)
-            hardware_trigger_sensor(t2);
+/* 是否有已发布、可被认领的事件（只读，不认领） */
+static bool event_ring_has_events(EventRing *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    return atomic_load_explicit(&r->slots[head & EVENT_QUEUE_MASK].seq, memory_order_acquire) == head + 1;
+}
 
-        /* 主循环处理事件（在此调用回调） */
-        process_event_queue();
+/* 消费者端（单消费者）：认领从 head 起连续已发布的一段（最多 max 个），
+   拷贝出来后只发布一次 head / 释放一次 reserved，而不是每个事件一次。
+   若某个生产者已拿票但尚未发布，认领在此处停下，下次再取。 */
+static size_t event_ring_pop_batch(EventRing *r, SensorEvent *out, size_t max)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t n = 0;
+    while (n < max)
+    {
+        EventSlot *slot = &r->slots[(head + n) & EVENT_QUEUE_MASK];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + (uint32_t)n + 1)
+            break;
+        out[n] = slot->ev;
+        ++n;
+    }
+    if (n == 0)
+        return 0;
+    atomic_store_explicit(&r->head, head + (uint32_t)n, memory_order_release);
+    if (r->mode == EVENT_RING_MPSC)
+        atomic_fetch_sub_explicit(&r->reserved, (uint32_t)n, memory_order_release);
+    return n;
+}
+
+/* ---------- 合并（last-value）模式 ---------- */
+
+/* 遥测类传感器不需要每个样本，只需要最新值：每个传感器一个待处理槽，
+   生产者用原子交换覆盖旧值并置位该类的脏位图，消费者按位图取走。
+   内存只与传感器数量有关；某个传感器再怎么刷屏也只占自己的一个槽，
+   不会挤掉其它传感器的更新（FIFO 环满时则会丢弃所有人的新事件）。 */
 
-        usleep(100 * 1000); /* 100ms，示例用 */
+#define CONFLATED_VALID (1ull << 32)
+#define CONFLATED_LANE_SHIFT 40
+
+static void conflate_push(Sensor *s, float val, uint64_t ts, unsigned lane)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    SizeClassPool *pool = &pools[SENSOR_HANDLE_CLASS(s->id)];
+    uint32_t idx = SENSOR_SLOT(s);
+    /* 时间戳与值分两次写，多生产者并发时 ts 可能来自稍新的一次写入，只影响延迟统计 */
+    atomic_store_explicit(&s->conflated_ts, ts, memory_order_relaxed);
+    uint64_t old = atomic_exchange_explicit(&s->conflated_value,
+                                            CONFLATED_VALID | (uint64_t)lane << CONFLATED_LANE_SHIFT | bits,
+                                            memory_order_release);
+    if (old & CONFLATED_VALID)
+    {
+        atomic_fetch_add_explicit(&s->counters.conflated, 1, memory_order_relaxed);
+        return; /* 脏位仍在（或消费者正在取），无需再置位 */
     }
+    atomic_fetch_or_explicit(&pool->dirty[idx / 64], 1ull << (idx % 64), memory_order_release);
+    atomic_store_explicit(&pool->dirty_any, true, memory_order_release);
+}
 
-    /* 停止并销毁 */
-    sensor_stop_async(t1);
-    sensor_stop_async(p1);
-    sensor_stop_async(t2);
+/* 消费者：按脏位图取出最多 max 个最新值。跨调用记住扫描位置，保证公平。 */
+static size_t conflate_drain(SensorEvent *out, size_t max)
+{
+    static int cls_cursor = 0;
+    size_t n = 0;
+    for (int k = 0; k < SENSOR_CLASS_COUNT && n < max; ++k)
+    {
+        int cls = (cls_cursor + k) % SENSOR_CLASS_COUNT;
+        SizeClassPool *pool = &pools[cls];
+        if (!atomic_exchange_explicit(&pool->dirty_any, false, memory_order_acquire))
+            continue;
+        size_t words = POOL_DIRTY_WORDS(pool->high_water);
+        for (size_t w = 0; w < words; ++w)
+        {
+            if (!atomic_load_explicit(&pool->dirty[w], memory_order_relaxed))
+                continue;
+            uint64_t bits = atomic_exchange_explicit(&pool->dirty[w], 0, memory_order_acquire);
+            while (bits)
+            {
+                unsigned b = (unsigned)__builtin_ctzll(bits);
+                if (n == max)
+                {
+                    /* 本批装满：把没处理的位放回去，下次再取 */
+                    atomic_fetch_or_explicit(&pool->dirty[w], bits, memory_order_relaxed);
+                    atomic_store_explicit(&pool->dirty_any, true, memory_order_relaxed);
+                    cls_cursor = cls;
+                    return n;
+                }
+                bits &= bits - 1;
+                Sensor *s = (Sensor *)(void *)(pool->objects + (w * 64 + b) * pool->stride);
+                uint64_t v = atomic_exchange_explicit(&s->conflated_value, 0, memory_order_acquire);
+                if (!(v & CONFLATED_VALID))
+                    continue;
+                uint32_t fbits = (uint32_t)v;
+                out[n].sensor = s;
+                out[n].handle = s->id;
+                memcpy(&out[n].value, &fbits, sizeof(float));
+                out[n].timestamp_ns = atomic_load_explicit(&s->conflated_ts, memory_order_relaxed);
+                out[n].lane = (uint8_t)(v >> CONFLATED_LANE_SHIFT);
+                ++n;
+            }
+        }
+    }
+    cls_cursor = (cls_cursor + 1) % SENSOR_CLASS_COUNT;
+    return n;
+}
 
-    destroy_sensor(t1);
-    destroy_sensor(p1);
-    destroy_sensor(t2);
+/* 设置优先级：之后的事件进入对应 lane（已在队列中的不移动） */
+void sensor_set_priority(Sensor *s, SensorPriority prio)
+{
+    if (s && prio < SENSOR_PRIORITY_COUNT)
+        atomic_store_explicit(&s->priority, (uint8_t)prio, memory_order_relaxed);
+}
 
-    return 0;
+/* 切换某传感器的投递模式：true = 合并（只保留最新值），false = FIFO 事件环 */
+void sensor_set_conflating(Sensor *s, bool on)
+{
+    if (s)
+        atomic_store_explicit(&s->conflating, on, memory_order_relaxed);
 }
+
+/* 在 ISR 上下文调用：尽量小，返回是否推入成功（false => 丢弃事件） */
+static bool isr_push_event(Sensor *s, float val)
+{
+    uint64_t ts = monotonic_ns();
+    unsigned lane = atomic_load_explicit(&s->priority, memory_order_relaxed);
+    if (atomic_load_explicit(&s->conflating, memory_order_relaxed))
+    {
+        /* 不经过事件环，但仍按优先级计入该 lane，各 lane 之和与 pushes 一致 */
+        atomic_fetch_add_explicit(&s->counters.pushes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&lane_pushes[lane], 1, memory_order_relaxed);
+        conflate_push(s, val, ts, lane);
+        return true;
+    }
+    SensorEvent ev = {.sensor = s, .handle = s->id, .value = val, .timestamp_ns = ts, .lane = (uint8_t)lane};
+    if (event_ring_push(&event_lanes[lane], &ev))
+    {
+        atomic_fetch_add_explicit(&s->counters.pushes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&lane_pushes[lane], 1, memory_order_relaxed);
+        return true;
+    }
+    /* 该 lane 满 — 在 ISR 中不能阻塞，丢弃事件并计数（其它 lane 不受影响） */
+    atomic_fetch_add_explicit(&s->counters.drops, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&lane_drops[lane], 1, memory_order_relaxed);
+    return false;
+}
+
+/* ---------- 窗口聚合：在事件环与回调之间按窗口汇总 ---------- */
+
+/* 窗口由若干 pane（窗格）组成，每个 pane 用 Welford 算法增量维护
+   count/min/max/mean/M2，O(1) 每样本、不保存原始样本。pane 关闭时把最近
+   panes 个 pane 用 Chan 的并行公式合并成一个摘要并回调一次：
+   panes = 1 为滚动窗口，panes > 1 为每个 pane 滑动一次的滑动窗口。
+   pane 的边界可以按样本数，也可以按推入时间戳（时间窗只在下一个样本到达时关闭）。
+   状态由调用方提供（与对象池一样不 malloc），只在该传感器的分发上下文中访问。 */
+
+#define SENSOR_WINDOW_MAX_PANES 16
+
+typedef struct
+{
+    uint64_t pane_ns;      /* 时间窗：每个 pane 的时长（ns）；0 = 按样本数 */
+    uint32_t pane_samples; /* 计数窗：每个 pane 的样本数 */
+    uint32_t panes;        /* 窗口包含的 pane 数，1..SENSOR_WINDOW_MAX_PANES */
+    uint32_t downsample;   /* 每 N 个样本取 1 个进入窗口；0/1 = 全部 */
+} SensorWindowConfig;
+
+typedef struct
+{
+    uint64_t count;
+    float min;
+    float max;
+    double mean;
+    double m2; /* 与均值之差的平方和 */
+    uint64_t start_ns;
+    uint64_t end_ns;
+} WindowPane;
+
+struct SensorWindow
+{
+    SensorWindowConfig cfg;
+    sensor_window_callback_t cb;
+    WindowPane panes[SENSOR_WINDOW_MAX_PANES]; /* 环形，cur 为正在累积的 pane */
+    uint32_t cur;
+    uint64_t pane_id; /* 时间窗：当前 pane 的编号（ts / pane_ns） */
+    uint32_t skip;    /* 降采样计数 */
+};
+
+static void window_pane_add(WindowPane *p, float v, uint64_t ts)
+{
+    if (p->count == 0)
+    {
+        p->min = p->max = v;
+        p->start_ns = ts;
+    }
+    else
+    {
+        if (v < p->min)
+            p->min = v;
+        if (v > p->max)
+            p->max = v;
+    }
+    p->end_ns = ts;
+    p->count++;
+    double delta = v - p->mean;
+    p->mean += delta / (double)p->count;
+    p->m2 += delta * (v - p->mean);
+}
+
+/* 合并两个 pane 的统计量（Chan et al.），与逐样本累积的结果等价 */
+static void window_pane_merge(WindowPane *into, const WindowPane *b)
+{
+    if (b->count == 0)
+        return;
+    if (into->count == 0)
+    {
+        *into = *b;
+        return;
+    }
+    uint64_t n = into->count + b->count;
+    double delta = b->mean - into->mean;
+    into->mean += delta * (double)b->count / (double)n;
+    into->m2 += b->m2 + delta * delta * (double)into->count * (double)b->count / (double)n;
+    into->count = n;
+    if (b->min < into->min)
+        into->min = b->min;
+    if (b->max > into->max)
+        into->max = b->max;
+    if (b->start_ns < into->start_ns)
+        into->start_ns = b->start_ns;
+    if (b->end_ns > into->end_ns)
+        into->end_ns = b->end_ns;
+}
+
+/* 前进到下一个 pane（清空它；滑动时它是窗口里最旧的那个） */
+static void window_next_pane(SensorWindow *w)
+{
+    w->cur = (w->cur + 1) % w->cfg.panes;
+    memset(&w->panes[w->cur], 0, sizeof(WindowPane));
+}
+
+/* 关闭当前 pane：合并最近 panes 个 pane 回调一次，然后前进 */
+static void window_close_pane(Sensor *s, SensorWindow *w)
+{
+    WindowPane acc = {0};
+    for (uint32_t k = 0; k < w->cfg.panes; ++k)
+        window_pane_merge(&acc, &w->panes[k]);
+    SensorWindowSummary sum = {
+        .count = acc.count,
+        .min = acc.min,
+        .max = acc.max,
+        .mean = acc.mean,
+        .variance = acc.count ? acc.m2 / (double)acc.count : 0.0,
+        .start_ns = acc.start_ns,
+        .end_ns = acc.end_ns};
+    w->cb(s, &sum, s->cb_ctx);
+    window_next_pane(w);
+}
+
+static void window_feed(Sensor *s, SensorWindow *w, float v, uint64_t ts)
+{
+    if (w->cfg.downsample > 1 && (w->skip++ % w->cfg.downsample) != 0)
+        return;
+    if (w->cfg.pane_ns)
+    {
+        uint64_t id = ts / w->cfg.pane_ns;
+        if (w->panes[w->cur].count && id > w->pane_id)
+        {
+            window_close_pane(s, w);
+            /* 中间没有样本的 pane 也要占位，否则滑动窗口会包含过期的 pane */
+            uint64_t gap = id - w->pane_id - 1;
+            if (gap > w->cfg.panes)
+                gap = w->cfg.panes;
+            for (uint64_t k = 0; k < gap; ++k)
+                window_next_pane(w);
+        }
+        if (w->panes[w->cur].count == 0)
+            w->pane_id = id;
+    }
+    window_pane_add(&w->panes[w->cur], v, ts);
+    if (!w->cfg.pane_ns && w->panes[w->cur].count >= w->cfg.pane_samples)
+        window_close_pane(s, w);
+}
+
+/* 按句柄稳定排序（插入排序，批次最多 DISPATCH_BATCH_MAX 个），
+   同一传感器的事件保持原有先后顺序。 */
+static void group_events_by_sensor(SensorEvent *evs, size_t n)
+{
+    for (size_t i = 1; i < n; ++i)
+    {
+        SensorEvent cur = evs[i];
+        size_t j = i;
+        while (j > 0 && evs[j - 1].handle > cur.handle)
+        {
+            evs[j] = evs[j - 1];
+            --j;
+        }
+        evs[j] = cur;
+    }
+}
+
+/* 把同一传感器的一组事件交给回调：有窗口则先聚合，有 batch_cb 则一次调用，否则逐个调用 cb */
+static void dispatch_sensor_group(SensorHandle h, const SensorEvent *evs, size_t n)
+{
+    Sensor *s = sensor_from_handle(h); /* 事件入队后传感器被销毁则丢弃 */
+    if (!s || !s->async_enabled || (!s->window && !s->batch_cb && !s->cb))
+        return;
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < n; ++i)
+        latency_record(evs[i].lane, now > evs[i].timestamp_ns ? now - evs[i].timestamp_ns : 0);
+    atomic_fetch_add_explicit(&s->counters.delivered, n, memory_order_relaxed);
+    if (s->window)
+    {
+        for (size_t i = 0; i < n; ++i)
+            window_feed(s, s->window, evs[i].value, evs[i].timestamp_ns);
+    }
+    else if (s->batch_cb)
+    {
+        float values[DISPATCH_BATCH_MAX];
+        for (size_t i = 0; i < n; ++i)
+            values[i] = evs[i].value;
+        s->batch_cb(s, values, n, s->cb_ctx);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+            s->cb(s, evs[i].value, s->cb_ctx);
+    }
+}
+
+/* 对一批（已认领的）事件按传感器分组并分发 */
+static void dispatch_events(SensorEvent *batch, size_t n)
+{
+    group_events_by_sensor(batch, n);
+    size_t start = 0;
+    while (start < n)
+    {
+        size_t end = start + 1;
+        while (end < n && batch[end].handle == batch[start].handle)
+            ++end;
+        dispatch_sensor_group(batch[start].handle, batch + start, end - start);
+        start = end;
+    }
+}
+
+/* ---------- 多线程回调分发：按传感器分片 + 整片窃取 ---------- */
+
+/* 事件按句柄哈希到 DISPATCH_SHARDS 个分片，每个分片一个 SPSC 环
+   （生产者是调用 process_event_queue 的线程）。一个分片同一时刻只被一个线程
+   认领（busy 标志），因此同一传感器的事件严格按序回调。
+   每个工作线程优先处理自己的“主场”分片（k % workers == self）；主场无事可做时
+   去窃取其它分片 —— 整片认领，例如主场线程正卡在某个慢回调里时，
+   它的其它分片会被空闲线程接走。 */
+
+#define DISPATCH_SHARDS 64
+#define DISPATCH_MAX_WORKERS 16
+#define DISPATCH_DRAIN_BUDGET 4 /* 每次认领最多处理的批数，之后让出分片 */
+#define DISPATCH_BUSY_WAIT_NS 1000000 /* 剩余事件都在别人占着的分片里时，最长睡这么久再重扫 */
+
+typedef struct
+{
+    EventRing ring;
+    _Alignas(CACHE_LINE_SIZE) atomic_bool busy;
+} DispatchShard;
+
+typedef struct
+{
+    DispatchShard shards[DISPATCH_SHARDS];
+    pthread_t threads[DISPATCH_MAX_WORKERS];
+    unsigned workers;
+    atomic_bool running;
+    atomic_bool stopping;
+    _Atomic uint32_t pending; /* 已路由但尚未回调的事件数 */
+    _Atomic uint32_t idle;    /* 正在等待的工作线程数 */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} Dispatcher;
+
+static Dispatcher dispatcher = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+static _Thread_local int dispatch_current_shard = -1;
+
+static unsigned shard_of(SensorHandle h)
+{
+    return (unsigned)((h * 2654435761u) >> 26) % DISPATCH_SHARDS;
+}
+
+static void shard_acquire(DispatchShard *sh)
+{
+    bool expected = false;
+    while (!atomic_compare_exchange_weak_explicit(&sh->busy, &expected, true, memory_order_acquire, memory_order_relaxed))
+    {
+        expected = false;
+        sched_yield();
+    }
+}
+
+static void shard_release(DispatchShard *sh)
+{
+    atomic_store_explicit(&sh->busy, false, memory_order_release);
+}
+
+/* 放出仍有事件的分片时叫醒一个空闲线程：它可能正因这个分片被占着而在睡 */
+static void shard_release_notify(DispatchShard *sh)
+{
+    shard_release(sh);
+    if (event_ring_has_events(&sh->ring) && atomic_load(&dispatcher.idle) > 0)
+    {
+        pthread_mutex_lock(&dispatcher.lock);
+        pthread_cond_signal(&dispatcher.wake);
+        pthread_mutex_unlock(&dispatcher.lock);
+    }
+}
+
+/* 尝试认领并处理分片 k；分片为空或正被别人处理时返回 false */
+static bool shard_try_drain(unsigned k)
+{
+    DispatchShard *sh = &dispatcher.shards[k];
+    if (!event_ring_has_events(&sh->ring))
+        return false;
+    bool expected = false;
+    if (!atomic_compare_exchange_strong_explicit(&sh->busy, &expected, true, memory_order_acquire, memory_order_relaxed))
+        return false;
+
+    dispatch_current_shard = (int)k;
+    SensorEvent batch[DISPATCH_BATCH_MAX];
+    size_t n;
+    for (int round = 0; round < DISPATCH_DRAIN_BUDGET; ++round)
+    {
+        n = event_ring_pop_batch(&sh->ring, batch, DISPATCH_BATCH_MAX);
+        if (n == 0)
+            break;
+        dispatch_events(batch, n);
+        atomic_fetch_sub_explicit(&dispatcher.pending, (uint32_t)n, memory_order_release);
+    }
+    dispatch_current_shard = -1;
+    shard_release_notify(sh);
+    return true;
+}
+
+static void *dispatch_worker(void *arg)
+{
+    unsigned self = (unsigned)(uintptr_t)arg;
+    unsigned workers = dispatcher.workers;
+    for (;;)
+    {
+        bool did = false;
+        for (unsigned k = self; k < DISPATCH_SHARDS; k += workers)
+            did |= shard_try_drain(k);
+        if (!did)
+        {
+            for (unsigned k = 0; k < DISPATCH_SHARDS; ++k)
+                if (k % workers != self)
+                    did |= shard_try_drain(k);
+        }
+        if (did)
+            continue;
+
+        /* 无事可做：pending 与 idle 都用 seq_cst，保证不会丢失唤醒。
+           pending > 0 却什么都没认领到，说明剩下的事件都在正被别人处理的分片里
+           （例如卡在慢回调里）：不能空转，睡到分片被放出（shard_release_notify）
+           或新事件路由进来，超时只是兜底。 */
+        pthread_mutex_lock(&dispatcher.lock);
+        atomic_fetch_add(&dispatcher.idle, 1);
+        if (atomic_load(&dispatcher.pending) != 0)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline); /* 条件变量默认按 CLOCK_REALTIME 计时 */
+            deadline.tv_nsec += DISPATCH_BUSY_WAIT_NS;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&dispatcher.wake, &dispatcher.lock, &deadline);
+        }
+        while (atomic_load(&dispatcher.pending) == 0 && !atomic_load(&dispatcher.stopping))
+            pthread_cond_wait(&dispatcher.wake, &dispatcher.lock);
+        atomic_fetch_sub(&dispatcher.idle, 1);
+        bool quit = atomic_load(&dispatcher.stopping) && atomic_load(&dispatcher.pending) == 0;
+        pthread_mutex_unlock(&dispatcher.lock);
+        if (quit)
+            break;
+    }
+    return NULL;
+}
+
+/* 启动 workers 个回调线程；之后 process_event_queue() 只负责路由事件 */
+bool dispatcher_start(unsigned workers)
+{
+    if (workers == 0 || workers > DISPATCH_MAX_WORKERS || atomic_load(&dispatcher.running))
+        return false;
+    for (unsigned k = 0; k < DISPATCH_SHARDS; ++k)
+    {
+        event_ring_init(&dispatcher.shards[k].ring, EVENT_RING_SPSC);
+        atomic_store(&dispatcher.shards[k].busy, false);
+    }
+    dispatcher.workers = workers;
+    atomic_store(&dispatcher.pending, 0);
+    atomic_store(&dispatcher.idle, 0);
+    atomic_store(&dispatcher.stopping, false);
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        if (pthread_create(&dispatcher.threads[i], NULL, dispatch_worker, (void *)(uintptr_t)i) != 0)
+        {
+            dispatcher.workers = i;
+            atomic_store(&dispatcher.stopping, true);
+            pthread_cond_broadcast(&dispatcher.wake);
+            for (unsigned j = 0; j < i; ++j)
+                pthread_join(dispatcher.threads[j], NULL);
+            return false;
+        }
+    }
+    atomic_store(&dispatcher.running, true);
+    return true;
+}
+
+/* 把一个事件路由到它的分片；分片满时让出 CPU 等待（反压到主事件环） */
+static void dispatcher_route(const SensorEvent *ev)
+{
+    DispatchShard *sh = &dispatcher.shards[shard_of(ev->handle)];
+    while (!event_ring_push(&sh->ring, ev))
+        sched_yield();
+    atomic_fetch_add(&dispatcher.pending, 1);
+    if (atomic_load(&dispatcher.idle) > 0)
+    {
+        pthread_mutex_lock(&dispatcher.lock);
+        pthread_cond_signal(&dispatcher.wake);
+        pthread_mutex_unlock(&dispatcher.lock);
+    }
+}
+
+/* 与某传感器的回调互斥（用于修改其回调注册）。在该分片自己的回调里调用时无需再加锁。 */
+static bool dispatcher_lock_sensor(const Sensor *s)
+{
+    if (!atomic_load(&dispatcher.running))
+        return false;
+    unsigned k = shard_of(s->id);
+    if (dispatch_current_shard == (int)k)
+        return false;
+    shard_acquire(&dispatcher.shards[k]);
+    return true;
+}
+
+static void dispatcher_unlock_sensor(const Sensor *s, bool locked)
+{
+    if (locked)
+        shard_release_notify(&dispatcher.shards[shard_of(s->id)]);
+}
+
+static void process_event_queue(void);
+
+/* 干净关闭：先把主环里剩余事件路由完，等所有已路由事件回调结束，再停线程 */
+void dispatcher_stop(void)
+{
+    if (!atomic_load(&dispatcher.running))
+        return;
+    process_event_queue();
+    pthread_mutex_lock(&dispatcher.lock);
+    atomic_store(&dispatcher.stopping, true);
+    pthread_cond_broadcast(&dispatcher.wake);
+    pthread_mutex_unlock(&dispatcher.lock);
+    for (unsigned i = 0; i < dispatcher.workers; ++i)
+        pthread_join(dispatcher.threads[i], NULL);
+    atomic_store(&dispatcher.running, false);
+}
+
+/* 把消费者取到的一批事件交出去：分发器运行时按传感器路由到分片由工作线程回调，
+   否则就地按传感器分组后每组只做一次分发 */
+static void deliver_batch(SensorEvent *batch, size_t n)
+{
+    if (atomic_load_explicit(&dispatcher.running, memory_order_relaxed))
+    {
+        for (size_t i = 0; i < n; ++i)
+            dispatcher_route(&batch[i]);
+    }
+    else
+    {
+        dispatch_events(batch, n);
+    }
+}
+
+/* ---------- 采样记录与回放：mmap 环形日志 ---------- */
+
+/* 定长二进制记录，预分配的文件整体 mmap（MAP_SHARED），按环形追加：
+   消费者线程（唯一写者）取出一批事件后直接写进映射内存，没有中间缓冲，
+   也没有 write() 系统调用，刷盘交给页缓存。写满后覆盖最旧的记录。
+   头部的 write_index 是累计写入条数，回放时据此找到最旧的一条。 */
+
+#define SAMPLE_LOG_MAGIC 0x3130434552464653ull /* "SFFREC01" */
+
+typedef struct
+{
+    uint64_t timestamp_ns; /* 原始推入时刻（单调时钟） */
+    uint32_t sensor_id;    /* 记录时的句柄 */
+    float value;
+    uint8_t type; /* SensorClass 或 SENSOR_KIND_DYNAMIC */
+    uint8_t reserved[7];
+} SampleRecord;
+
+_Static_assert(sizeof(SampleRecord) == 24, "SampleRecord layout is part of the file format");
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t capacity;                 /* 记录槽数 */
+    _Atomic uint64_t write_index;      /* 累计写入条数，写者以 release 发布 */
+    uint8_t pad[CACHE_LINE_SIZE - 32]; /* 记录区从下一条 cache line 开始 */
+} SampleLogHeader;
+
+_Static_assert(sizeof(SampleLogHeader) == CACHE_LINE_SIZE, "SampleLogHeader must fill one cache line");
+
+typedef struct
+{
+    SampleLogHeader *hdr; /* NULL = 未在记录 */
+    SampleRecord *records;
+    size_t map_bytes;
+    int fd;
+} SampleRecorder;
+
+static SampleRecorder recorder = {.fd = -1};
+
+/* 创建（截断）并预分配可容纳 capacity 条记录的环形日志文件，开始记录。
+   须在 process_event_queue() 未运行时调用。 */
+bool sample_recorder_open(const char *path, uint64_t capacity)
+{
+#ifdef _WIN32
+    (void)path;
+    (void)capacity;
+    return false;
+#else
+    if (recorder.hdr || !path || capacity == 0)
+        return false;
+    size_t bytes = sizeof(SampleLogHeader) + (size_t)capacity * sizeof(SampleRecord);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    /* 先把块真正分配出来，记录时不会因缺页分配磁盘块或 SIGBUS */
+    if (posix_fallocate(fd, 0, (off_t)bytes) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    SampleLogHeader *hdr = (SampleLogHeader *)map;
+    hdr->magic = SAMPLE_LOG_MAGIC;
+    hdr->record_size = sizeof(SampleRecord);
+    hdr->capacity = capacity;
+    atomic_store_explicit(&hdr->write_index, 0, memory_order_relaxed);
+    recorder.hdr = hdr;
+    recorder.records = (SampleRecord *)(void *)(hdr + 1);
+    recorder.map_bytes = bytes;
+    recorder.fd = fd;
+    return true;
+#endif
+}
+
+/* 停止记录并解除映射（文件保留，可用于回放） */
+void sample_recorder_close(void)
+{
+#ifndef _WIN32
+    if (!recorder.hdr)
+        return;
+    msync(recorder.hdr, recorder.map_bytes, MS_ASYNC);
+    munmap(recorder.hdr, recorder.map_bytes);
+    close(recorder.fd);
+    recorder.hdr = NULL;
+    recorder.records = NULL;
+    recorder.fd = -1;
+#endif
+}
+
+/* 消费者线程调用：把刚取出的一批事件直接写入映射区。每条只是几次普通存储，
+   每批只发布一次 write_index。 */
+static void sample_recorder_append(const SensorEvent *evs, size_t n)
+{
+    SampleLogHeader *hdr = recorder.hdr;
+    uint64_t w = atomic_load_explicit(&hdr->write_index, memory_order_relaxed);
+    uint64_t cap = hdr->capacity;
+    for (size_t i = 0; i < n; ++i)
+    {
+        SampleRecord *r = &recorder.records[(w + i) % cap];
+        r->timestamp_ns = evs[i].timestamp_ns;
+        r->sensor_id = evs[i].handle;
+        r->value = evs[i].value;
+        r->type = evs[i].sensor->kind;
+    }
+    atomic_store_explicit(&hdr->write_index, w + n, memory_order_release);
+}
+
+/* 回放时把记录里的 sensor_id 映射到当前进程的传感器；返回 NULL 跳过该条 */
+typedef Sensor *(*sample_replay_resolve_t)(uint32_t sensor_id, uint8_t type, void *ctx);
+
+static Sensor *replay_resolve_by_handle(uint32_t sensor_id, uint8_t type, void *ctx)
+{
+    (void)type;
+    (void)ctx;
+    return sensor_from_handle(sensor_id);
+}
+
+/* 把日志按时间顺序（从最旧一条开始）重新注入：等价于 hardware_trigger_sensor，
+   只是值取自记录而不是读硬件。speed = 1 按原始间隔，> 1 加速，<= 0 不等待。
+   在调用线程里边注入边 process_event_queue()，与演示主循环相同。
+   resolve 为 NULL 时按原句柄查找（同一进程、同样的创建顺序下有效）。
+   返回成功推入的记录数（lane 满被丢弃的不算，照常计入 counters.drops），
+   打开/校验失败返回 -1。 */
+long long sample_replay(const char *path, double speed, sample_replay_resolve_t resolve, void *ctx)
+{
+#ifdef _WIN32
+    (void)path;
+    (void)speed;
+    (void)resolve;
+    (void)ctx;
+    return -1;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t)sizeof(SampleLogHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    const SampleLogHeader *hdr = (const SampleLogHeader *)map;
+    /* size >= 头部已在上面检查；容量用除法比较，损坏头部里的巨大 capacity 不会让乘法回绕 */
+    if (hdr->magic != SAMPLE_LOG_MAGIC || hdr->record_size != sizeof(SampleRecord) || hdr->capacity == 0 ||
+        hdr->capacity > ((uint64_t)size - sizeof(SampleLogHeader)) / sizeof(SampleRecord))
+    {
+        munmap(map, (size_t)size);
+        return -1;
+    }
+    if (!resolve)
+        resolve = replay_resolve_by_handle;
+
+    const SampleRecord *records = (const SampleRecord *)(const void *)(hdr + 1);
+    uint64_t written = atomic_load_explicit(&((SampleLogHeader *)hdr)->write_index, memory_order_acquire);
+    uint64_t count = written < hdr->capacity ? written : hdr->capacity;
+    uint64_t first = written - count;
+    uint64_t wall0 = monotonic_ns();
+    uint64_t ts0 = count ? records[first % hdr->capacity].timestamp_ns : 0;
+    long long injected = 0;
+    for (uint64_t k = 0; k < count; ++k)
+    {
+        const SampleRecord *r = &records[(first + k) % hdr->capacity];
+        if (speed > 0 && r->timestamp_ns > ts0)
+        {
+            uint64_t due = wall0 + (uint64_t)((double)(r->timestamp_ns - ts0) / speed);
+            if (due > monotonic_ns())
+            {
+                process_event_queue(); /* 睡之前先把已注入的交付掉 */
+                struct timespec ts = {.tv_sec = (time_t)(due / 1000000000ull), .tv_nsec = (long)(due % 1000000000ull)};
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                    ;
+            }
+        }
+        Sensor *s = resolve(r->sensor_id, r->type, ctx);
+        if (!sensor_is_live(s))
+            continue;
+        if (!isr_push_event(s, r->value))
+        {
+            process_event_queue(); /* lane 已满：先腾出来，这一条已按丢弃计数 */
+            continue;
+        }
+        if ((++injected & (EVENT_QUEUE_DEPTH / 2 - 1)) == 0)
+            process_event_queue(); /* 不限速时及时腾出事件环，避免自己把环灌满 */
+    }
+    process_event_queue();
+    munmap(map, (size_t)size);
+    return injected;
+#endif
+}
+
+/* 低优先级 lane 有事件却连续被更高 lane 抢先这么多批后，强制让它取一批 */
+#define LANE_STARVE_BUDGET 8
+
+/* 选出下一批要取的 lane：通常是最高的非空 lane；某条非空的低 lane 已被跳过
+   LANE_STARVE_BUDGET 次时改取它。全部为空返回 -1。 */
+static int pick_event_lane(void)
+{
+    static unsigned skipped[SENSOR_PRIORITY_COUNT];
+    int top = -1;
+    for (int prio = 0; prio < SENSOR_PRIORITY_COUNT; ++prio)
+    {
+        if (!event_ring_has_events(&event_lanes[prio]))
+            continue;
+        if (top < 0)
+        {
+            top = prio;
+            continue;
+        }
+        if (++skipped[prio] > LANE_STARVE_BUDGET)
+        {
+            skipped[prio] = 0;
+            return prio;
+        }
+    }
+    if (top >= 0)
+        skipped[top] = 0;
+    return top;
+}
+
+/* 主循环调用（单一线程），处理并调用用户回调（非 ISR）。
+   FIFO lane 按优先级取一批，与合并模式的脏位图交替，任何一边持续繁忙都不会饿死另一边。 */
+static void process_event_queue(void)
+{
+    SensorEvent batch[DISPATCH_BATCH_MAX];
+    for (;;)
+    {
+        int lane = pick_event_lane();
+        size_t fifo = lane < 0 ? 0 : event_ring_pop_batch(&event_lanes[lane], batch, DISPATCH_BATCH_MAX);
+        if (fifo)
+        {
+            if (recorder.hdr)
+                sample_recorder_append(batch, fifo); /* 分发前记录：分组会重排 batch */
+            deliver_batch(batch, fifo);
+        }
+        size_t latest = conflate_drain(batch, DISPATCH_BATCH_MAX);
+        if (latest)
+        {
+            if (recorder.hdr)
+                sample_recorder_append(batch, latest);
+            deliver_batch(batch, latest);
+        }
+        if (fifo == 0 && latest == 0)
+            break;
+    }
+}
+
+/* ---------- 硬件中断模拟：在 ISR 中读取硬件并 push_event ---------- */
+
+/* 真实系统中，这个函数会在 ISR 中被调用（或被 ISR 标记/触发）。
+   对于示例，我们在 main 的循环中调用它来模拟中断触发。
+*/
+void hardware_trigger_sensor(Sensor *s)
+{
+    if (!sensor_is_live(s))
+        return;
+    /* ISR: 读取原始数据（已知类型内联换算，其余经 vptr->read），然后 push 到队列。
+       注意：在真实 ISR 中，可能需要读取硬件寄存器/ADC 而不是调用复杂函数。
+    */
+    float val = sensor_read(s); /* 同步转换，假设快 */
+    isr_push_event(s, val);       /* 失败时已计入 counters.drops */
+}
+
+/* 同一 tick 到期的一批传感器一次触发（时间轮在同一 deadline 上合并调用） */
+void hardware_trigger_batch(Sensor *const *sensors, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        Sensor *s = sensors[i];
+        isr_push_event(s, sensor_read(s));
+    }
+}
+
+/* ---------- 采样调度：分层时间轮 ---------- */
+
+/* 4 级 × 64 槽，1 tick = 1ms，覆盖 64^4 ms（约 4.6 小时），更远的到期时间夹到最高级。
+   结构与 Linux 经典 timer wheel 相同：第 0 级按 tick 精确到期，高一级的槽在低一级
+   转满一圈时下放（cascade）。每级一个 64 位占用位图，用 ctz 找下一个非空槽，
+   因此求“下一个到期时间”与传感器数量无关。主循环只在真正有到期（或需要下放）
+   的时刻醒来，醒来次数与到期的 deadline 数成正比，而不是与传感器数成正比。 */
+
+#define TW_LEVELS 4
+#define TW_BITS 6
+#define TW_SLOTS (1u << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_MAX_DELTA ((1ull << (TW_LEVELS * TW_BITS)) - 1)
+#define TW_TICK_NS 1000000ull
+#define TW_BATCH_MAX 64
+
+typedef struct
+{
+    TimerNode *slots[TW_LEVELS][TW_SLOTS];
+    uint64_t occupied[TW_LEVELS]; /* 非空槽位图 */
+    uint64_t next_tick;           /* 下一个待处理的 tick */
+    bool started;
+} TimingWheel;
+
+static TimingWheel sampler;
+
+uint64_t sampler_now_tick(void)
+{
+    return monotonic_ns() / TW_TICK_NS;
+}
+
+static void tw_link(TimingWheel *w, TimerNode *t)
+{
+    uint64_t expires = t->expires;
+    uint64_t delta = expires > w->next_tick ? expires - w->next_tick : 0;
+    if (delta > TW_MAX_DELTA)
+    {
+        delta = TW_MAX_DELTA;
+        expires = w->next_tick + delta;
+    }
+    if (expires < w->next_tick)
+        expires = w->next_tick; /* 已过期：放到当前槽，下一次推进时处理 */
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ull << (TW_BITS * (level + 1))))
+        ++level;
+    unsigned idx = (unsigned)(expires >> (TW_BITS * level)) & TW_MASK;
+
+    TimerNode **head = &w->slots[level][idx];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->slot = (uint16_t)(level * TW_SLOTS + idx);
+    w->occupied[level] |= 1ull << idx;
+}
+
+static void tw_unlink(TimingWheel *w, TimerNode *t)
+{
+    if (!t->pprev)
+        return;
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    unsigned level = t->slot / TW_SLOTS, idx = t->slot % TW_SLOTS;
+    if (!w->slots[level][idx])
+        w->occupied[level] &= ~(1ull << idx);
+}
+
+/* 把第 level 级的 idx 槽整体下放到更低的级别 */
+static void tw_cascade(TimingWheel *w, int level, unsigned idx)
+{
+    TimerNode *t = w->slots[level][idx];
+    w->slots[level][idx] = NULL;
+    w->occupied[level] &= ~(1ull << idx);
+    while (t)
+    {
+        TimerNode *next = t->next;
+        tw_link(w, t);
+        t = next;
+    }
+}
+
+/* 设置采样周期与相位（毫秒）。相位是相对“现在”的首个采样偏移。 */
+bool sensor_set_sampling(Sensor *s, uint32_t period_ms, uint32_t phase_ms)
+{
+    if (!sensor_is_live(s) || period_ms == 0)
+        return false;
+    if (!sampler.started)
+    {
+        sampler.next_tick = sampler_now_tick();
+        sampler.started = true;
+    }
+    TimerNode *t = &s->sample_timer;
+    tw_unlink(&sampler, t);
+    t->period = period_ms;
+    t->expires = sampler_now_tick() + phase_ms;
+    tw_link(&sampler, t);
+    return true;
+}
+
+void sensor_cancel_sampling(Sensor *s)
+{
+    if (!s)
+        return;
+    tw_unlink(&sampler, &s->sample_timer);
+    s->sample_timer.period = 0;
+}
+
+/* 下一个事件的 tick。exact=false 时高级别返回下放时间（推进时不能越过下放点）；
+   exact=true 时扫描高级别第一个非空槽求真实最早到期时间（用于睡眠，避免为下放而醒来）。
+   同一级中靠后的槽到期更晚，所以每级只需看第一个非空槽。 */
+static uint64_t tw_next_deadline(TimingWheel *w, bool exact)
+{
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < TW_LEVELS; ++level)
+    {
+        uint64_t bits = w->occupied[level];
+        if (!bits)
+            continue;
+        unsigned shift = TW_BITS * (unsigned)level;
+        uint64_t unit = 1ull << shift;
+        uint64_t base = (w->next_tick >> (shift + TW_BITS)) << (shift + TW_BITS); /* 本圈起点 */
+        unsigned cur = (unsigned)(w->next_tick >> shift) & TW_MASK;
+        /* 高级别的当前槽只有恰好停在其下放点（低位全 0）时还未下放，否则只能是下一圈；
+           第 0 级 unit == 1，当前槽总是有效 */
+        unsigned first = (w->next_tick & (unit - 1)) == 0 ? cur : cur + 1;
+        uint64_t ahead = first < TW_SLOTS ? bits >> first << first : 0;
+        unsigned idx = (unsigned)__builtin_ctzll(ahead ? ahead : bits);
+        uint64_t when = base + ((ahead ? 0 : (uint64_t)TW_SLOTS) + idx) * unit;
+        if (exact && level > 0)
+        {
+            when = UINT64_MAX;
+            for (const TimerNode *t = w->slots[level][idx]; t; t = t->next)
+                if (t->expires < when)
+                    when = t->expires;
+        }
+        if (when < w->next_tick)
+            when = w->next_tick;
+        if (when < best)
+            best = when;
+    }
+    return best;
+}
+
+/* 推进到 now（含），到期的传感器按 tick 分批触发后重新按周期挂回。
+   返回触发的传感器数。 */
+size_t sampler_advance(uint64_t now)
+{
+    TimingWheel *w = &sampler;
+    size_t fired = 0;
+    while (w->next_tick <= now)
+    {
+        /* 整段空闲直接跳到下一个 deadline（跳跃不会越过任何下放点） */
+        uint64_t next = tw_next_deadline(w, false);
+        if (next > now)
+        {
+            w->next_tick = now + 1;
+            break;
+        }
+        w->next_tick = next;
+
+        uint64_t tick = w->next_tick;
+        unsigned idx = (unsigned)tick & TW_MASK;
+        for (int level = 1; level < TW_LEVELS; ++level)
+        {
+            if ((tick & ((1ull << (TW_BITS * level)) - 1)) != 0)
+                break;
+            tw_cascade(w, level, (unsigned)(tick >> (TW_BITS * level)) & TW_MASK);
+        }
+
+        TimerNode *t = w->slots[0][idx];
+        w->slots[0][idx] = NULL;
+        w->occupied[0] &= ~(1ull << idx);
+        w->next_tick = tick + 1;
+
+        Sensor *batch[TW_BATCH_MAX];
+        size_t n = 0;
+        while (t)
+        {
+            TimerNode *nx = t->next;
+            t->next = NULL;
+            t->pprev = NULL;
+            Sensor *s = (Sensor *)(void *)((char *)t - offsetof(Sensor, sample_timer));
+            batch[n++] = s;
+            t->expires += t->period;
+            if (t->expires <= tick)
+                t->expires = tick + t->period; /* 落后太多时不补采 */
+            tw_link(w, t);
+            if (n == TW_BATCH_MAX)
+            {
+                hardware_trigger_batch(batch, n);
+                fired += n;
+                n = 0;
+            }
+            t = nx;
+        }
+        if (n)
+        {
+            hardware_trigger_batch(batch, n);
+            fired += n;
+        }
+    }
+    return fired;
+}
+
+/* 睡到下一个 deadline（不超过 limit），然后推进时间轮。返回触发的传感器数。 */
+size_t sampler_wait_and_run(uint64_t limit_tick)
+{
+    uint64_t next = tw_next_deadline(&sampler, true);
+    if (next > limit_tick)
+        next = limit_tick;
+    if (next > sampler_now_tick())
+    {
+#ifdef _WIN32
+        Sleep((DWORD)(next - sampler_now_tick()));
+#else
+        uint64_t ns = next * TW_TICK_NS;
+        struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000ull), .tv_nsec = (long)(ns % 1000000000ull)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ; /* 被信号打断则继续睡；其它错误直接返回，不空转 */
+#endif
+    }
+    return sampler_advance(sampler_now_tick());
+}
+
+/* ---------- 异步 API（供客户端使用） ---------- */
+
+/* 启动异步采样（注册回调） */
+void sensor_start_async(Sensor *s, sensor_callback_t cb, void *ctx)
+{
+    if (!s)
+        return;
+    bool locked = dispatcher_lock_sensor(s);
+    s->cb = cb;
+    s->batch_cb = NULL;
+    s->window = NULL;
+    s->cb_ctx = ctx;
+    s->async_enabled = true;
+    dispatcher_unlock_sensor(s, locked);
+}
+
+/* 启动异步采样（注册批量回调：每批次每个传感器只回调一次） */
+void sensor_start_async_batch(Sensor *s, sensor_batch_callback_t batch_cb, void *ctx)
+{
+    if (!s)
+        return;
+    bool locked = dispatcher_lock_sensor(s);
+    s->cb = NULL;
+    s->batch_cb = batch_cb;
+    s->window = NULL;
+    s->cb_ctx = ctx;
+    s->async_enabled = true;
+    dispatcher_unlock_sensor(s, locked);
+}
+
+/* 启动异步采样（窗口聚合：每个窗口回调一次摘要）。w 由调用方提供，
+   在 sensor_stop_async 返回之前必须保持有效；未满的最后一个窗口不会回调。 */
+bool sensor_start_async_window(Sensor *s, SensorWindow *w, const SensorWindowConfig *cfg,
+                               sensor_window_callback_t cb, void *ctx)
+{
+    if (!s || !w || !cfg || !cb || cfg->panes == 0 || cfg->panes > SENSOR_WINDOW_MAX_PANES ||
+        (cfg->pane_ns == 0 && cfg->pane_samples == 0))
+        return false;
+    memset(w, 0, sizeof(*w));
+    w->cfg = *cfg;
+    w->cb = cb;
+    bool locked = dispatcher_lock_sensor(s);
+    s->cb = NULL;
+    s->batch_cb = NULL;
+    s->window = w;
+    s->cb_ctx = ctx;
+    s->async_enabled = true;
+    dispatcher_unlock_sensor(s, locked);
+    return true;
+}
+
+/* 停止异步采样。分发器运行时会等待该传感器正在执行的回调结束，
+   返回后不会再有它的回调被调用，可以安全释放 ctx。 */
+void sensor_stop_async(Sensor *s)
+{
+    if (!s)
+        return;
+    bool locked = dispatcher_lock_sensor(s);
+    s->async_enabled = false;
+    s->cb = NULL;
+    s->batch_cb = NULL;
+    s->window = NULL;
+    s->cb_ctx = NULL;
+    dispatcher_unlock_sensor(s, locked);
+}
+
+/* ---------- 压测：多生产者负载生成（-DSENSOR_FACTORY_BENCH） ---------- */
+
+#ifdef SENSOR_FACTORY_BENCH
+
+/* N 个生产者线程模拟中断，按固定速率（开环，落后时不等待直接补发）对各自的
+   传感器子集调用 hardware_trigger_sensor()，主线程不停地 process_event_queue()。
+   走的是真实的 create_* / ISR 推入 / 分发路径，结束后输出一行 JSON，
+   便于在不同队列深度（-DEVENT_QUEUE_DEPTH=...）、池配置之间对比。
+   用法：sensor_bench [--producers=N] [--sensors=M] [--rate=每生产者事件/秒，0=不限速]
+                      [--duration-ms=D] [--workers=W] [--conflate] [--record=文件]
+                      [--high=K 前 K 个传感器为高优先级，其余为低优先级]
+                      [--window=S 每 S 个样本一个滚动窗口摘要，代替逐样本回调] */
+
+#define BENCH_MAX_PRODUCERS 64
+
+typedef struct
+{
+    Sensor **sensors; /* 本生产者负责的传感器（按下标交错分配） */
+    size_t count;
+    uint64_t rate;     /* 每秒触发次数，0 = 尽可能快 */
+    uint64_t triggers; /* 实际触发次数 */
+    pthread_t thread;
+} BenchProducer;
+
+static atomic_bool bench_stop;
+static _Atomic uint64_t bench_callbacks;
+
+static void bench_cb(Sensor *s, float value, void *ctx)
+{
+    (void)s;
+    (void)value;
+    (void)ctx;
+    atomic_fetch_add_explicit(&bench_callbacks, 1, memory_order_relaxed);
+}
+
+static void bench_window_cb(Sensor *s, const SensorWindowSummary *summary, void *ctx)
+{
+    (void)s;
+    (void)summary;
+    (void)ctx;
+    atomic_fetch_add_explicit(&bench_callbacks, 1, memory_order_relaxed);
+}
+
+static void bench_sleep_until(uint64_t deadline_ns)
+{
+#ifdef _WIN32
+    uint64_t now = monotonic_ns();
+    if (deadline_ns > now)
+        Sleep((DWORD)((deadline_ns - now) / 1000000ull));
+#else
+    struct timespec ts = {.tv_sec = (time_t)(deadline_ns / 1000000000ull), .tv_nsec = (long)(deadline_ns % 1000000000ull)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+#endif
+}
+
+static void *bench_producer(void *arg)
+{
+    BenchProducer *p = (BenchProducer *)arg;
+    uint64_t period = p->rate ? 1000000000ull / p->rate : 0;
+    uint64_t next = monotonic_ns();
+    size_t i = 0;
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed))
+    {
+        if (period)
+        {
+            next += period;
+            if (next > monotonic_ns())
+                bench_sleep_until(next);
+        }
+        Sensor *s = p->sensors[i];
+        if (++i == p->count)
+            i = 0;
+        ++pools[SENSOR_HANDLE_CLASS(s->id)].raw[SENSOR_SLOT(s)]; /* 让样本值变化（每个传感器只有一个生产者写） */
+        hardware_trigger_sensor(s);
+        ++p->triggers;
+    }
+    return NULL;
+}
+
+static bool bench_arg(const char *arg, const char *name, unsigned long long *out)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    *out = strtoull(arg + len + 1, NULL, 10);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long producers = 2, sensors = 16, rate = 0, duration_ms = 1000, workers = 0, high = 0, window = 0;
+    bool conflate = false;
+    const char *record_path = NULL;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strncmp(argv[a], "--record=", 9) == 0)
+        {
+            record_path = argv[a] + 9;
+            continue;
+        }
+        if (bench_arg(argv[a], "--producers", &producers) || bench_arg(argv[a], "--sensors", &sensors) ||
+            bench_arg(argv[a], "--rate", &rate) || bench_arg(argv[a], "--duration-ms", &duration_ms) ||
+            bench_arg(argv[a], "--workers", &workers) || bench_arg(argv[a], "--high", &high) ||
+            bench_arg(argv[a], "--window", &window))
+            continue;
+        if (strcmp(argv[a], "--conflate") == 0)
+        {
+            conflate = true;
+            continue;
+        }
+        fprintf(stderr, "usage: %s [--producers=N] [--sensors=M] [--rate=R] [--duration-ms=D] [--workers=W] [--conflate] [--record=FILE] [--high=K] [--window=S]\n", argv[0]);
+        return 2;
+    }
+    if (producers == 0 || producers > BENCH_MAX_PRODUCERS || sensors < producers ||
+        sensors > (uint64_t)SENSOR_CLASS_COUNT * POOL_MAX_CAPACITY || workers > DISPATCH_MAX_WORKERS)
+    {
+        fprintf(stderr, "bad arguments: need 1 <= producers <= %d, producers <= sensors, workers <= %d\n",
+                BENCH_MAX_PRODUCERS, DISPATCH_MAX_WORKERS);
+        return 2;
+    }
+
+    /* 传感器按类型轮流创建，各类池按需要的容量配置 */
+    uint32_t per_class[SENSOR_CLASS_COUNT];
+    void *storage[SENSOR_CLASS_COUNT] = {NULL};
+    for (int cls = 0; cls < SENSOR_CLASS_COUNT; ++cls)
+    {
+        per_class[cls] = (uint32_t)((sensors + SENSOR_CLASS_COUNT - 1 - cls) / SENSOR_CLASS_COUNT);
+        if (per_class[cls] == 0)
+            continue;
+        size_t bytes = sensor_pool_storage_bytes((SensorClass)cls, per_class[cls]);
+        storage[cls] = malloc(bytes); /* malloc 满足 max_align_t 对齐 */
+        if (!storage[cls] || !sensor_pool_configure((SensorClass)cls, storage[cls], bytes))
+        {
+            fprintf(stderr, "pool setup failed\n");
+            return 1;
+        }
+    }
+
+    Sensor **all = (Sensor **)malloc(sensors * sizeof(Sensor *));
+    Sensor **by_producer = (Sensor **)malloc(sensors * sizeof(Sensor *));
+    SensorWindow *windows = window ? (SensorWindow *)malloc(sensors * sizeof(SensorWindow)) : NULL;
+    SensorWindowConfig window_cfg = {.pane_samples = (uint32_t)window, .panes = 1};
+    if (!all || !by_producer || (window && !windows))
+        return 1;
+    for (size_t i = 0; i < sensors; ++i)
+    {
+        all[i] = create_sensor((SensorClass)(i % SENSOR_CLASS_COUNT), NULL);
+        if (!all[i])
+        {
+            fprintf(stderr, "create failed at %zu\n", i);
+            return 1;
+        }
+        if (window)
+            sensor_start_async_window(all[i], &windows[i], &window_cfg, bench_window_cb, NULL);
+        else
+            sensor_start_async(all[i], bench_cb, NULL);
+        sensor_set_conflating(all[i], conflate);
+        if (high)
+            sensor_set_priority(all[i], i < high ? SENSOR_PRIORITY_HIGH : SENSOR_PRIORITY_LOW);
+    }
+
+    event_queue_init(EVENT_RING_MPSC);
+    if (record_path && !sample_recorder_open(record_path, 1u << 20))
+    {
+        fprintf(stderr, "cannot record to %s\n", record_path);
+        return 1;
+    }
+    if (workers && !dispatcher_start((unsigned)workers))
+    {
+        fprintf(stderr, "dispatcher_start failed\n");
+        return 1;
+    }
+
+    /* 传感器 i 归生产者 i % N，同一传感器只有一个生产者（与一条中断线对应） */
+    BenchProducer prod[BENCH_MAX_PRODUCERS];
+    size_t fill = 0;
+    for (unsigned long long k = 0; k < producers; ++k)
+    {
+        prod[k] = (BenchProducer){.sensors = by_producer + fill, .rate = rate};
+        for (size_t i = (size_t)k; i < sensors; i += (size_t)producers)
+            by_producer[fill++] = all[i];
+        prod[k].count = (size_t)(by_producer + fill - prod[k].sensors);
+    }
+
+    atomic_store(&bench_stop, false);
+    uint64_t start = monotonic_ns();
+    uint64_t end = start + duration_ms * 1000000ull;
+    for (unsigned long long k = 0; k < producers; ++k)
+    {
+        if (pthread_create(&prod[k].thread, NULL, bench_producer, &prod[k]) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+    while (monotonic_ns() < end)
+        process_event_queue();
+    atomic_store(&bench_stop, true);
+    uint64_t triggers = 0;
+    for (unsigned long long k = 0; k < producers; ++k)
+    {
+        pthread_join(prod[k].thread, NULL);
+        triggers += prod[k].triggers;
+    }
+    process_event_queue();
+    dispatcher_stop();
+    sample_recorder_close();
+    uint64_t elapsed = monotonic_ns() - start;
+
+    SensorStatsSnapshot st;
+    sensor_stats_snapshot(&st);
+    uint64_t offered = st.pushes + st.drops;
+    double secs = (double)elapsed / 1e9;
+    printf("{\"bench\":\"sensor_factory_async\",\"queue_depth\":%d,\"producers\":%llu,\"sensors\":%llu,"
+           "\"rate_per_producer\":%llu,\"workers\":%llu,\"conflate\":%s,\"record\":%s,\"duration_ns\":%llu,"
+           "\"triggers\":%llu,\"pushes\":%llu,\"drops\":%llu,\"conflated\":%llu,\"delivered\":%llu,"
+           "\"offered_per_sec\":%.0f,\"events_per_sec\":%.0f,\"drop_rate\":%.6f,"
+           "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"window\":%llu,\"callbacks\":%llu,\"high\":%llu,\"lanes\":[",
+           EVENT_QUEUE_DEPTH, producers, sensors, rate, workers, conflate ? "true" : "false",
+           record_path ? "true" : "false",
+           (unsigned long long)elapsed, (unsigned long long)triggers, (unsigned long long)st.pushes,
+           (unsigned long long)st.drops, (unsigned long long)st.conflated, (unsigned long long)st.delivered,
+           (double)offered / secs, (double)st.delivered / secs, offered ? (double)st.drops / (double)offered : 0.0,
+           (unsigned long long)st.p50_ns, (unsigned long long)st.p99_ns, (unsigned long long)st.p999_ns,
+           (unsigned long long)st.max_ns, window, (unsigned long long)atomic_load(&bench_callbacks), high);
+    for (int prio = 0; prio < SENSOR_PRIORITY_COUNT; ++prio)
+        printf("%s{\"pushes\":%llu,\"drops\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}", prio ? "," : "",
+               (unsigned long long)st.lanes[prio].pushes, (unsigned long long)st.lanes[prio].drops,
+               (unsigned long long)st.lanes[prio].p50_ns, (unsigned long long)st.lanes[prio].p99_ns,
+               (unsigned long long)st.lanes[prio].p999_ns);
+    printf("]}\n");
+
+    for (size_t i = 0; i < sensors; ++i)
+    {
+        sensor_stop_async(all[i]);
+        destroy_sensor(all[i]);
+    }
+    free(windows);
+    free(by_producer);
+    free(all);
+    for (int cls = 0; cls < SENSOR_CLASS_COUNT; ++cls)
+        free(storage[cls]);
+    return 0;
+}
+
+#else /* !SENSOR_FACTORY_BENCH */
+
+/* ---------- 客户端回调示例 ---------- */
+
+static void my_sensor_cb(Sensor *s, float value, void *ctx)
+{
+    const char *tag = (const char *)ctx;
+    printf("[callback] slot=%u type=%s tag=%s value=%.2f\n", SENSOR_HANDLE_INDEX(s->id), sensor_type_name(s), tag ? tag : "(null)", value);
+}
+
+static void my_sensor_batch_cb(Sensor *s, const float *values, size_t count, void *ctx)
+{
+    const char *tag = (const char *)ctx;
+    printf("[batch] slot=%u type=%s tag=%s count=%zu last=%.2f\n", SENSOR_HANDLE_INDEX(s->id), sensor_type_name(s), tag ? tag : "(null)", count, values[count - 1]);
+}
+
+static void my_sensor_window_cb(Sensor *s, const SensorWindowSummary *w, void *ctx)
+{
+    const char *tag = (const char *)ctx;
+    printf("[window] slot=%u type=%s tag=%s count=%llu min=%.2f max=%.2f mean=%.2f var=%.4f\n", SENSOR_HANDLE_INDEX(s->id),
+           sensor_type_name(s), tag ? tag : "(null)", (unsigned long long)w->count, w->min, w->max, w->mean, w->variance);
+}
+
+/* ---------- 测试主程序（模拟主循环 + 硬件触发） ---------- */
+
+int main(void)
+{
+    /* 创建一些传感器 */
+    SensorHandle t1_handle;
+    Sensor *t1 = create_temp_sensor(&t1_handle);
+    Sensor *p1 = create_pressure_sensor(NULL);
+    Sensor *t2 = create_temp_sensor(NULL);
+    Sensor *t3 = create_temp_sensor(NULL);
+
+    if (!t1 || !p1 || !t2 || !t3)
+    {
+        printf("create failed\n");
+        return 1;
+    }
+
+    /* 多个中断源可能并发推入，使用多生产者模式 */
+    event_queue_init(EVENT_RING_MPSC);
+
+    /* 注册异步回调（开始异步模式） */
+    sensor_start_async(t1, my_sensor_cb, "T1");
+    sensor_start_async(p1, my_sensor_cb, "P1");
+    sensor_start_async_batch(t2, my_sensor_batch_cb, "T2");
+
+    /* 高频传感器只要摘要：500ms 窗口（5 个 100ms pane），每 100ms 滑动一次 */
+    static SensorWindow t3_window;
+    SensorWindowConfig t3_cfg = {.pane_ns = 100000000ull, .panes = 5};
+    sensor_start_async_window(t3, &t3_window, &t3_cfg, my_sensor_window_cb, "T3");
+
+    /* 压力只关心最新值：改为合并模式 */
+    sensor_set_conflating(p1, true);
+
+    /* 回调交给 2 个工作线程执行（同一传感器仍按序） */
+    dispatcher_start(2);
+
+    /* 记录经过事件队列的全部样本，结束后回放 */
+    bool recording = sample_recorder_open("sensor_samples.bin", 1024);
+
+    /* 各传感器按自己的周期/相位采样（毫秒） */
+    sensor_set_sampling(t1, 100, 0);
+    sensor_set_sampling(p1, 300, 50);
+    sensor_set_sampling(t2, 200, 0);
+    sensor_set_sampling(t3, 10, 0);
+
+    /* 主循环：睡到下一个采样 deadline，到期的传感器由时间轮批量“硬件触发”，然后处理队列 */
+    uint64_t end = sampler_now_tick() + 2000;
+    int wakeups = 0;
+    while (sampler_now_tick() < end)
+    {
+        /* 模拟硬件更新一些内部原始值（演示） */
+        *temp_sensor_raw(t1) += 1;                              /* 温度慢慢上升 */
+        *pressure_sensor_raw(p1) += (wakeups % 3 == 0) ? 1 : 0; /* 偶尔变化 */
+        *temp_sensor_raw(t2) += (wakeups % 2 == 0) ? 2 : 0;
+        *temp_sensor_raw(t3) = (int16_t)(250 + wakeups % 7); /* 抖动 */
+
+        sampler_wait_and_run(end);
+        ++wakeups;
+
+        /* 主循环处理事件（在此调用回调） */
+        process_event_queue();
+    }
+    printf("wakeups=%d in 2000ms\n", wakeups);
+
+    if (recording)
+    {
+        sample_recorder_close();
+        /* 4 倍速回放，同一进程里原句柄仍然有效 */
+        printf("[replay] injected=%lld\n", sample_replay("sensor_samples.bin", 4.0, NULL, NULL));
+        dispatcher_stop(); /* 等回放的回调跑完，免得与下面的输出交错 */
+    }
+
+    /* 批量读取：一次换算同类型的全部传感器，代替逐个 vptr->read */
+    float temps[POOL_DEFAULT_CAPACITY];
+    size_t n_temps = sensor_read_all(SENSOR_CLASS_TEMP, temps, POOL_DEFAULT_CAPACITY);
+    for (size_t i = 0; i < n_temps; ++i)
+        printf("[bulk] temp slot=%zu value=%.2f\n", i, temps[i]);
+
+    /* 统计快照（不需要停止生产者） */
+    SensorStatsSnapshot stats;
+    sensor_stats_snapshot(&stats);
+    printf("[stats] pushes=%llu drops=%llu conflated=%llu delivered=%llu p50=%lluns p99=%lluns p999=%lluns\n",
+           (unsigned long long)stats.pushes, (unsigned long long)stats.drops, (unsigned long long)stats.conflated,
+           (unsigned long long)stats.delivered,
+           (unsigned long long)stats.p50_ns, (unsigned long long)stats.p99_ns, (unsigned long long)stats.p999_ns);
+
+    /* 停止并销毁 */
+    sensor_stop_async(t1);
+    sensor_stop_async(p1);
+    sensor_stop_async(t2);
+    sensor_stop_async(t3);
+    dispatcher_stop();
+
+    destroy_sensor(t1);
+    destroy_sensor(p1);
+    destroy_sensor(t2);
+    destroy_sensor(t3);
+
+    /* 销毁后旧句柄/指针失效，可以廉价地检测出来 */
+    printf("stale handle -> %s, stale pointer live=%d\n",
+           sensor_from_handle(t1_handle) ? "object" : "NULL", sensor_is_live(t1));
+
+    return 0;
+}
+
+#endif /* SENSOR_FACTORY_BENCH */
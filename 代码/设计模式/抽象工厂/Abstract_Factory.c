@@ -1,5 +1,414 @@
+// 编译: gcc -std=c11 -O2 -pthread Abstract_Factory.c -o Abstract_Factory
+//      可加 -DDEV_LOG_LEVEL=DEV_LOG_LEVEL_WARN 在编译期去掉设备的 INFO 日志
+
+#define _POSIX_C_SOURCE 200809L // nanosleep
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+// ==================== 异步日志 ====================
+
+// 设备热路径上不再直接 printf（持有 stdio 锁并在调用线程里格式化）。
+// 生产者只把“格式串指针 + 数值参数”写进本线程自己的 SPSC 环（无锁、无格式化），
+// 后台线程按线程逐个取出、格式化并输出。格式串必须是字符串字面量（静态存储期），
+// 参数只支持整数和浮点。环满时丢弃并计数，从不阻塞设备代码。
+// 线程退出时经 pthread_key 析构把自己的环标记为退役，后台线程取空后摘链释放。
+
+#define DEV_LOG_LEVEL_DEBUG 0
+#define DEV_LOG_LEVEL_INFO 1
+#define DEV_LOG_LEVEL_WARN 2
+#define DEV_LOG_LEVEL_ERROR 3
+#define DEV_LOG_LEVEL_OFF 4
+
+// 编译期级别：低于它的 DEV_LOG 调用整体被编译器删掉
+#ifndef DEV_LOG_LEVEL
+#define DEV_LOG_LEVEL DEV_LOG_LEVEL_INFO
+#endif
+
+#define DEV_LOG_MAX_ARGS 3
+#define DEV_LOG_BUFFER_RECORDS 1024 // 每线程环的记录数，必须为 2 的幂
+
+typedef union
+{
+    long long i;
+    double d;
+} LogArg;
+
+typedef struct
+{
+    const char *fmt; // 格式 id：字面量地址
+    uint8_t level;
+    uint8_t nargs;
+    LogArg args[DEV_LOG_MAX_ARGS];
+} LogRecord;
+
+typedef struct LogBuffer
+{
+    _Atomic uint32_t head; // 后台线程读
+    _Atomic uint32_t tail; // 所属线程写
+    _Atomic uint64_t dropped;
+    atomic_bool writing;    // 所属线程正在写一条记录（dev_log_stop 据此等它写完）
+    atomic_bool retired;    // 所属线程已退出，不会再写
+    struct LogBuffer *next; // 全局链表：生产者只在表头插入，只有取数的一方摘除
+    LogRecord records[DEV_LOG_BUFFER_RECORDS];
+} LogBuffer;
+
+static _Atomic(LogBuffer *) log_buffers;
+static _Thread_local LogBuffer *log_local;
+static atomic_bool log_running;
+static pthread_t log_thread;
+static pthread_key_t log_key; // 只为线程退出时的析构回调，值就是该线程的环
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static _Atomic uint64_t log_passes; // 后台线程完成的取数轮数，dev_log_flush 据此等待
+static uint64_t log_dropped_retired; // 已释放的环累计的丢弃数（只由取数的一方读写）
+
+static inline LogArg dev_log_arg_i(long long v) { return (LogArg){.i = v}; }
+static inline LogArg dev_log_arg_f(double v) { return (LogArg){.d = v}; }
+
+#define DEV_LOG_ARG(x) _Generic((x), float: dev_log_arg_f, double: dev_log_arg_f, default: dev_log_arg_i)(x)
+#define DEV_LOG_ARGS_1(a) DEV_LOG_ARG(a)
+#define DEV_LOG_ARGS_2(a, b) DEV_LOG_ARG(a), DEV_LOG_ARG(b)
+#define DEV_LOG_ARGS_3(a, b, c) DEV_LOG_ARG(a), DEV_LOG_ARG(b), DEV_LOG_ARG(c)
+#define DEV_LOG_PICK(_1, _2, _3, name, ...) name
+#define DEV_LOG_ARGS(...) DEV_LOG_PICK(__VA_ARGS__, DEV_LOG_ARGS_3, DEV_LOG_ARGS_2, DEV_LOG_ARGS_1, )(__VA_ARGS__)
+
+// 用法：DEV_LOG(DEV_LOG_LEVEL_INFO, "LED %d: ON\n", id); 支持 1~3 个数值参数
+#define DEV_LOG(level, fmt, ...)                                                           \
+    do                                                                                     \
+    {                                                                                      \
+        if ((level) >= DEV_LOG_LEVEL)                                                      \
+        {                                                                                  \
+            const LogArg dev_log_args_[] = {DEV_LOG_ARGS(__VA_ARGS__)};                    \
+            dev_log_write((level), (fmt), dev_log_args_,                                   \
+                          (unsigned)(sizeof(dev_log_args_) / sizeof(dev_log_args_[0])));   \
+        }                                                                                  \
+    } while (0)
+
+// 按格式串逐个转换说明格式化：整数统一按 long long 输出，浮点按 double
+static void log_format(FILE *out, const char *fmt, const LogArg *args, unsigned nargs)
+{
+    unsigned next = 0;
+    for (const char *p = fmt; *p; ++p)
+    {
+        if (*p != '%')
+        {
+            fputc(*p, out);
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            fputc('%', out);
+            ++p;
+            continue;
+        }
+        char spec[32] = "%";
+        size_t len = 1;
+        ++p;
+        while (*p && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 4)
+            spec[len++] = *p++;
+        while (*p && strchr("hlLqjzt", *p))
+            ++p; // 长度修饰由这里统一决定
+        char conv = *p;
+        if (!conv)
+            break;
+        LogArg a = next < nargs ? args[next] : (LogArg){.i = 0};
+        ++next;
+        if (strchr("diouxXc", conv))
+        {
+            if (conv != 'c')
+            {
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+            }
+            spec[len++] = conv;
+            spec[len] = '\0';
+            if (conv == 'c')
+                fprintf(out, spec, (int)a.i);
+            else if (conv == 'd' || conv == 'i')
+                fprintf(out, spec, a.i);
+            else
+                fprintf(out, spec, (unsigned long long)a.i);
+        }
+        else if (strchr("fFeEgGaA", conv))
+        {
+            spec[len++] = conv;
+            spec[len] = '\0';
+            fprintf(out, spec, a.d);
+        }
+        else
+        {
+            fputc('?', out); // 不支持 %s/%p：记录里只有数值
+        }
+    }
+}
+
+static void log_buffer_retire(void *p)
+{
+    atomic_store_explicit(&((LogBuffer *)p)->retired, true, memory_order_release);
+}
+
+static void log_key_create(void)
+{
+    pthread_key_create(&log_key, log_buffer_retire);
+}
+
+// 取出并格式化所有线程环里的记录，返回处理条数。同一时刻只能有一个取数方
+// （后台线程，或停止后的 dev_log_stop），退役的环取空后在这里摘链释放。
+static size_t log_drain_all(void)
+{
+    size_t n = 0;
+    LogBuffer *prev = NULL;
+    LogBuffer *b = atomic_load_explicit(&log_buffers, memory_order_acquire);
+    while (b)
+    {
+        // 先读 retired 再读 tail：退役前的最后一次 tail 发布一定能看到，取完即为空
+        bool retired = atomic_load_explicit(&b->retired, memory_order_acquire);
+        uint32_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&b->tail, memory_order_acquire);
+        for (; head != tail; ++head, ++n)
+        {
+            const LogRecord *r = &b->records[head & (DEV_LOG_BUFFER_RECORDS - 1)];
+            log_format(stdout, r->fmt, r->args, r->nargs);
+        }
+        atomic_store_explicit(&b->head, head, memory_order_release);
+
+        LogBuffer *next = b->next;
+        if (retired)
+        {
+            // 表头可能正被新线程插入：CAS 失败就留到下一轮
+            LogBuffer *expected = b;
+            bool unlinked = prev ? (prev->next = next, true)
+                                 : atomic_compare_exchange_strong(&log_buffers, &expected, next);
+            if (unlinked)
+            {
+                log_dropped_retired += atomic_load_explicit(&b->dropped, memory_order_relaxed);
+                free(b);
+                b = next;
+                continue;
+            }
+        }
+        prev = b;
+        b = next;
+    }
+    return n;
+}
+
+static void *log_thread_main(void *arg)
+{
+    (void)arg;
+    struct timespec idle = {.tv_sec = 0, .tv_nsec = 1000000}; // 空闲时 1ms 轮询一次
+    while (atomic_load_explicit(&log_running, memory_order_acquire))
+    {
+        size_t n = log_drain_all();
+        atomic_fetch_add_explicit(&log_passes, 1, memory_order_release);
+        if (n == 0)
+        {
+            fflush(stdout);
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+// 生产者：写入本线程的环。首次调用时分配并登记本线程的环。
+// 后台线程未启动（或正在停止）时退化为同步输出，保证日志不丢。
+void dev_log_write(int level, const char *fmt, const LogArg *args, unsigned nargs)
+{
+    if (!atomic_load_explicit(&log_running, memory_order_relaxed))
+    {
+        log_format(stdout, fmt, args, nargs);
+        return;
+    }
+    LogBuffer *b = log_local;
+    if (!b)
+    {
+        b = (LogBuffer *)calloc(1, sizeof(LogBuffer));
+        if (!b)
+            return;
+        b->next = atomic_load_explicit(&log_buffers, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&log_buffers, &b->next, b))
+            ;
+        log_local = b;
+        pthread_setspecific(log_key, b);
+    }
+    // 与 dev_log_stop 的握手（都是 seq_cst）：要么这里看到 log_running 已清，
+    // 要么 stop 看到 writing 而等这条记录发布后再做最后一次取数
+    atomic_store(&b->writing, true);
+    if (!atomic_load(&log_running))
+    {
+        atomic_store_explicit(&b->writing, false, memory_order_release);
+        log_format(stdout, fmt, args, nargs);
+        return;
+    }
+    uint32_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&b->head, memory_order_acquire) >= DEV_LOG_BUFFER_RECORDS)
+    {
+        atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+        atomic_store_explicit(&b->writing, false, memory_order_release);
+        return;
+    }
+    LogRecord *r = &b->records[tail & (DEV_LOG_BUFFER_RECORDS - 1)];
+    r->fmt = fmt;
+    r->level = (uint8_t)level;
+    r->nargs = (uint8_t)(nargs < DEV_LOG_MAX_ARGS ? nargs : DEV_LOG_MAX_ARGS);
+    for (unsigned i = 0; i < r->nargs; ++i)
+        r->args[i] = args[i];
+    atomic_store_explicit(&b->tail, tail + 1, memory_order_release);
+    atomic_store_explicit(&b->writing, false, memory_order_release);
+}
+
+bool dev_log_start(void)
+{
+    if (atomic_load(&log_running))
+        return false;
+    pthread_once(&log_key_once, log_key_create);
+    atomic_store(&log_running, true);
+    if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0)
+    {
+        atomic_store(&log_running, false);
+        return false;
+    }
+    return true;
+}
+
+// 等到调用前写入的记录都已输出（与直接 printf 的输出保持先后顺序时用）。
+// 不遍历环链表（后台线程会释放退役的环），而是等后台线程从头完整取过一轮：
+// 调用时正在进行的那一轮可能已经越过本线程的环，所以要等两轮。
+void dev_log_flush(void)
+{
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 100000};
+    uint64_t start = atomic_load_explicit(&log_passes, memory_order_acquire);
+    while (atomic_load(&log_running) && atomic_load_explicit(&log_passes, memory_order_acquire) - start < 2)
+        nanosleep(&wait, NULL);
+    fflush(stdout);
+}
+
+// 停止后台线程并输出剩余记录：先清 log_running，等正在写的线程把记录发布完，
+// 再做最后一次取数。存活线程的环不释放（线程仍持有指针），之后的日志退化为同步输出。
+void dev_log_stop(void)
+{
+    if (!atomic_load(&log_running))
+        return;
+    atomic_store(&log_running, false);
+    pthread_join(log_thread, NULL);
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 10000};
+    for (LogBuffer *b = atomic_load(&log_buffers); b; b = b->next)
+        while (atomic_load(&b->writing))
+            nanosleep(&wait, NULL);
+    log_drain_all();
+    uint64_t dropped = log_dropped_retired;
+    for (LogBuffer *b = atomic_load(&log_buffers); b; b = b->next)
+        dropped += atomic_load_explicit(&b->dropped, memory_order_relaxed);
+    if (dropped)
+        printf("[log] %llu records dropped (buffer full)\n", (unsigned long long)dropped);
+    fflush(stdout);
+}
+
+// ==================== 模拟数据：每线程 PRNG ====================
+
+// xoshiro256**：每个线程一份 256 位状态（_Thread_local），没有全局锁和隐藏共享状态。
+// 用 sim_rng_seed(seed, stream) 播种：同一 (seed, stream) 总是产生同一序列，
+// 多线程仿真给每个线程不同的 stream 即可复现。未播种的线程使用 (SIM_RNG_DEFAULT_SEED, 0)。
+
+#define SIM_RNG_DEFAULT_SEED 0x5EED5EED5EED5EEDull
+
+typedef struct
+{
+    uint64_t s[4];
+    bool seeded;
+} SimRng;
+
+static _Thread_local SimRng sim_rng;
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// 为调用线程播种；stream 区分同一 seed 下的不同线程
+void sim_rng_seed(uint64_t seed, uint64_t stream)
+{
+    uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+    for (int i = 0; i < 4; ++i)
+        sim_rng.s[i] = splitmix64(&x);
+    sim_rng.seeded = true;
+}
+
+static inline uint64_t xoshiro_next(uint64_t *s)
+{
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+uint64_t sim_rng_next(void)
+{
+    if (!sim_rng.seeded)
+        sim_rng_seed(SIM_RNG_DEFAULT_SEED, 0);
+    return xoshiro_next(sim_rng.s);
+}
+
+// [0, n) 内均匀分布的整数（Lemire 乘法取高位，代替 % 取模）。
+// 只取高位时 n 不整除 2^32 就有偏差：低 32 位落在 [0, 2^32 mod n) 的结果要拒绝重取，
+// 取模只在低位小于 n 的罕见情况下才算一次。
+static inline uint32_t xoshiro_below(uint64_t s[4], uint32_t n)
+{
+    uint64_t m = (xoshiro_next(s) >> 32) * n;
+    uint32_t lo = (uint32_t)m;
+    if (lo < n)
+    {
+        uint32_t t = -n % n;
+        while (lo < t)
+        {
+            m = (xoshiro_next(s) >> 32) * n;
+            lo = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+uint32_t sim_rng_below(uint32_t n)
+{
+    if (!sim_rng.seeded)
+        sim_rng_seed(SIM_RNG_DEFAULT_SEED, 0);
+    return xoshiro_below(sim_rng.s, n);
+}
+
+// 批量生成模拟读数：out[i] = base + k * step，k 在 [0, steps) 内均匀。
+// 状态在循环中留在寄存器里，不逐个经过 TLS，适合一次刷新成千上万个设备。
+void sim_rng_fill_readings(float *out, size_t n, float base, float step, uint32_t steps)
+{
+    if (!sim_rng.seeded)
+        sim_rng_seed(SIM_RNG_DEFAULT_SEED, 0);
+    uint64_t s[4] = {sim_rng.s[0], sim_rng.s[1], sim_rng.s[2], sim_rng.s[3]};
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = base + (float)xoshiro_below(s, steps) * step;
+    }
+    for (int i = 0; i < 4; ++i)
+        sim_rng.s[i] = s[i];
+}
 
 // ==================== 抽象产品接口 ====================
 
@@ -42,14 +451,14 @@ typedef struct
 void temp_sensor_read(void *self)
 {
     TemperatureSensor *sensor = (TemperatureSensor *)self;
-    sensor->temperature = 25.0f + (rand() % 100) * 0.1f; // 模拟温度读数
-    printf("Temperature Sensor %d: %.1f\n", sensor->id, sensor->temperature);
+    sensor->temperature = 25.0f + sim_rng_below(100) * 0.1f; // 模拟温度读数
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Temperature Sensor %d: %.1f\n", sensor->id, sensor->temperature);
 }
 
 void temp_sensor_init(void *self)
 {
     TemperatureSensor *sensor = (TemperatureSensor *)self;
-    printf("Temperature Sensor %d initialized\n", sensor->id);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Temperature Sensor %d initialized\n", sensor->id);
 }
 
 int temp_sensor_get_id(void *self)
@@ -74,14 +483,14 @@ typedef struct
 void humidity_sensor_read(void *self)
 {
     HumiditySensor *sensor = (HumiditySensor *)self;
-    sensor->humidity = 40.0f + (rand() % 400) * 0.1f; // 模拟湿度读数
-    printf("Humidity Sensor %d: %.1f%%\n", sensor->id, sensor->humidity);
+    sensor->humidity = 40.0f + sim_rng_below(400) * 0.1f; // 模拟湿度读数
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Humidity Sensor %d: %.1f%%\n", sensor->id, sensor->humidity);
 }
 
 void humidity_sensor_init(void *self)
 {
     HumiditySensor *sensor = (HumiditySensor *)self;
-    printf("Humidity Sensor %d initialized\n", sensor->id);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Humidity Sensor %d initialized\n", sensor->id);
 }
 
 int humidity_sensor_get_id(void *self)
@@ -107,14 +516,14 @@ void led_activate(void *self)
 {
     LedActuator *led = (LedActuator *)self;
     led->is_on = 1;
-    printf("LED %d: ON\n", led->id);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "LED %d: ON\n", led->id);
 }
 
 void led_deactivate(void *self)
 {
     LedActuator *led = (LedActuator *)self;
     led->is_on = 0;
-    printf("LED %d: OFF\n", led->id);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "LED %d: OFF\n", led->id);
 }
 
 int led_get_status(void *self)
@@ -142,7 +551,7 @@ void motor_activate(void *self)
     MotorActuator *motor = (MotorActuator *)self;
     motor->is_running = 1;
     motor->speed = 100;
-    printf("Motor %d: Running at %d%% speed\n", motor->id, motor->speed);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Motor %d: Running at %d%% speed\n", motor->id, motor->speed);
 }
 
 void motor_deactivate(void *self)
@@ -150,7 +559,7 @@ void motor_deactivate(void *self)
     MotorActuator *motor = (MotorActuator *)self;
     motor->is_running = 0;
     motor->speed = 0;
-    printf("Motor %d: Stopped\n", motor->id);
+    DEV_LOG(DEV_LOG_LEVEL_INFO, "Motor %d: Stopped\n", motor->id);
 }
 
 int motor_get_status(void *self)
@@ -164,65 +573,504 @@ static const ActuatorVTable motor_vtable = {
     .deactivate = motor_deactivate,
     .get_status = motor_get_status};
 
+// ==================== 设备内存：线性 arena ====================
+
+// 启动时一次性申请一大块内存，之后所有设备都从里面顺序切出（bump 分配），
+// 创建 O(1)、没有逐个 malloc；设备与 arena 同生命周期，整体 reset/释放。
+typedef struct
+{
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+} DeviceArena;
+
+bool device_arena_init(DeviceArena *arena, size_t capacity)
+{
+    arena->base = (unsigned char *)malloc(capacity); // 整个 arena 只有这一次分配
+    arena->capacity = arena->base ? capacity : 0;
+    arena->used = 0;
+    return arena->base != NULL;
+}
+
+// 丢弃 arena 中的全部设备（不释放内存，可重新创建）
+void device_arena_reset(DeviceArena *arena)
+{
+    arena->used = 0;
+}
+
+void device_arena_release(DeviceArena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+}
+
+// 按 max_align_t 对齐切出 size 字节，空间不足返回 NULL
+void *device_arena_alloc(DeviceArena *arena, size_t size)
+{
+    size_t align = _Alignof(max_align_t);
+    size_t offset = (arena->used + align - 1) & ~(align - 1);
+    if (offset > arena->capacity || size > arena->capacity - offset)
+        return NULL;
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+// ==================== 设备注册表：按 id 的开放寻址哈希 ====================
+
+// 工厂创建的每个设备都登记在这里。每种设备（传感器/执行器）一条连续的
+// DeviceEntry 数组，按种类遍历就是顺序扫描；id 索引是线性探测哈希表，
+// 槽里直接存 id 和条目引用，查找只在探测命中时才去访问条目。
+// 装载率不超过 1/2，查找期望 O(1)。设备随 arena 一起释放，因此不支持单个删除。
+
+typedef enum
+{
+    DEVICE_KIND_SENSOR = 0,
+    DEVICE_KIND_ACTUATOR,
+    DEVICE_KIND_COUNT
+} DeviceKind;
+
+typedef struct
+{
+    int id;
+    void *device; // Sensor * 或 Actuator *
+} DeviceEntry;
+
+typedef struct
+{
+    int id;
+    uint32_t ref; // (条目下标 << 1 | 种类) + 1，0 表示空槽
+} DeviceIndexSlot;
+
+typedef struct
+{
+    DeviceEntry *entries[DEVICE_KIND_COUNT];
+    size_t count[DEVICE_KIND_COUNT];
+    size_t capacity[DEVICE_KIND_COUNT];
+    DeviceIndexSlot *index;
+    size_t index_mask;
+} DeviceRegistry;
+
+static size_t device_id_hash(int id)
+{
+    uint32_t h = (uint32_t)id;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static void device_index_insert(DeviceIndexSlot *index, size_t mask, int id, uint32_t ref)
+{
+    size_t slot = device_id_hash(id) & mask;
+    while (index[slot].ref)
+        slot = (slot + 1) & mask;
+    index[slot].id = id;
+    index[slot].ref = ref;
+}
+
+static bool device_registry_grow_index(DeviceRegistry *reg, size_t slots)
+{
+    DeviceIndexSlot *index = (DeviceIndexSlot *)calloc(slots, sizeof(DeviceIndexSlot));
+    if (!index)
+        return false;
+    for (int kind = 0; kind < DEVICE_KIND_COUNT; ++kind)
+        for (size_t i = 0; i < reg->count[kind]; ++i)
+            device_index_insert(index, slots - 1, reg->entries[kind][i].id, (uint32_t)((i << 1 | (size_t)kind) + 1));
+    free(reg->index);
+    reg->index = index;
+    reg->index_mask = slots - 1;
+    return true;
+}
+
+bool device_registry_init(DeviceRegistry *reg, size_t expected)
+{
+    memset(reg, 0, sizeof(*reg));
+    size_t slots = 16;
+    while (slots < expected * 2)
+        slots <<= 1;
+    return device_registry_grow_index(reg, slots);
+}
+
+void device_registry_release(DeviceRegistry *reg)
+{
+    for (int kind = 0; kind < DEVICE_KIND_COUNT; ++kind)
+        free(reg->entries[kind]);
+    free(reg->index);
+    memset(reg, 0, sizeof(*reg));
+}
+
+// 为再登记 n 个 kind 类设备预留空间（条目数组按倍数增长，索引保持装载率 <= 1/2）
+static bool device_registry_reserve(DeviceRegistry *reg, DeviceKind kind, size_t n)
+{
+    size_t need = reg->count[kind] + n;
+    if (need > UINT32_MAX / 4)
+        return false;
+    if (need > reg->capacity[kind])
+    {
+        size_t cap = reg->capacity[kind] ? reg->capacity[kind] : 16;
+        while (cap < need)
+            cap *= 2;
+        DeviceEntry *entries = (DeviceEntry *)realloc(reg->entries[kind], cap * sizeof(DeviceEntry));
+        if (!entries)
+            return false;
+        reg->entries[kind] = entries;
+        reg->capacity[kind] = cap;
+    }
+    size_t total = n;
+    for (int k = 0; k < DEVICE_KIND_COUNT; ++k)
+        total += reg->count[k];
+    size_t slots = reg->index_mask + 1;
+    if (total * 2 > slots)
+    {
+        while (total * 2 > slots)
+            slots <<= 1;
+        return device_registry_grow_index(reg, slots);
+    }
+    return true;
+}
+
+// 按 id 查找设备，找不到返回 NULL；kind_out 可为 NULL
+void *device_find(const DeviceRegistry *reg, int id, DeviceKind *kind_out)
+{
+    size_t slot = device_id_hash(id) & reg->index_mask;
+    while (reg->index[slot].ref)
+    {
+        if (reg->index[slot].id == id)
+        {
+            uint32_t ref = reg->index[slot].ref - 1;
+            DeviceKind kind = (DeviceKind)(ref & 1);
+            if (kind_out)
+                *kind_out = kind;
+            return reg->entries[kind][ref >> 1].device;
+        }
+        slot = (slot + 1) & reg->index_mask;
+    }
+    return NULL;
+}
+
+// 按种类遍历：返回该种类全部设备的连续条目数组
+const DeviceEntry *device_registry_entries(const DeviceRegistry *reg, DeviceKind kind, size_t *count)
+{
+    *count = reg->count[kind];
+    return reg->entries[kind];
+}
+
+// 登记前先预留空间，这里不会失败
+static void device_registry_add(DeviceRegistry *reg, DeviceKind kind, int id, void *device)
+{
+    size_t i = reg->count[kind]++;
+    reg->entries[kind][i].id = id;
+    reg->entries[kind][i].device = device;
+    device_index_insert(reg->index, reg->index_mask, id, (uint32_t)((i << 1 | (size_t)kind) + 1));
+}
+
+// 批量创建前的检查：id 都未登记过、批内也互不重复，且注册表有足够空间。
+// 批内查重用一张临时的开放寻址表（与索引同一哈希），只存本批 id。
+static bool device_registry_prepare(DeviceRegistry *reg, DeviceKind kind, const int *ids, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        if (device_find(reg, ids[i], NULL))
+            return false;
+    if (n > 1)
+    {
+        size_t slots = 16;
+        while (slots < n * 2)
+            slots <<= 1;
+        DeviceIndexSlot *seen = (DeviceIndexSlot *)calloc(slots, sizeof(DeviceIndexSlot));
+        if (!seen)
+            return false;
+        bool unique = true;
+        for (size_t i = 0; i < n && unique; ++i)
+        {
+            size_t slot = device_id_hash(ids[i]) & (slots - 1);
+            while (seen[slot].ref && seen[slot].id != ids[i])
+                slot = (slot + 1) & (slots - 1);
+            unique = !seen[slot].ref;
+            seen[slot].id = ids[i];
+            seen[slot].ref = 1;
+        }
+        free(seen);
+        if (!unique)
+            return false;
+    }
+    return device_registry_reserve(reg, kind, n);
+}
+
 // ==================== 抽象工厂接口 ====================
 
+// 产品族：描述一个工厂生产的传感器/执行器的大小和就地构造函数，
+// 这样工厂可以一次为 n 个设备申请连续内存，再逐个构造。
+typedef struct
+{
+    size_t sensor_size;
+    size_t actuator_size;
+    void (*construct_sensor)(void *mem, int id);
+    void (*construct_actuator)(void *mem, int id);
+} DeviceFamily;
+
+// 工厂实例 = 产品族 + 设备所在的 arena + 可选的注册表（NULL 则不登记）
 typedef struct
 {
-    Sensor *(*create_sensor)(int id);
-    Actuator *(*create_actuator)(int id);
+    const DeviceFamily *family;
+    DeviceArena *arena;
+    DeviceRegistry *registry;
 } DeviceFactory;
 
 // ==================== 具体工厂实现 ====================
 
 // 环境监测工厂 - 创建温度传感器和LED
-Sensor *create_environment_sensor(int id)
+void construct_environment_sensor(void *mem, int id)
 {
-    static TemperatureSensor sensor;
-    sensor.base.vtable = &temp_sensor_vtable;
-    sensor.id = id;
-    sensor.temperature = 0.0f;
-    sensor.base.vtable->init(&sensor);
-    return (Sensor *)&sensor;
+    TemperatureSensor *sensor = (TemperatureSensor *)mem;
+    sensor->base.vtable = &temp_sensor_vtable;
+    sensor->id = id;
+    sensor->temperature = 0.0f;
+    sensor->base.vtable->init(sensor);
 }
 
-Actuator *create_environment_actuator(int id)
+void construct_environment_actuator(void *mem, int id)
 {
-    static LedActuator actuator;
-    actuator.base.vtable = &led_vtable;
-    actuator.id = id;
-    actuator.is_on = 0;
-    return (Actuator *)&actuator;
+    LedActuator *actuator = (LedActuator *)mem;
+    actuator->base.vtable = &led_vtable;
+    actuator->id = id;
+    actuator->is_on = 0;
 }
 
 // 运动控制工厂 - 创建湿度传感器和电机
-Sensor *create_motion_sensor(int id)
+void construct_motion_sensor(void *mem, int id)
 {
-    static HumiditySensor sensor;
-    sensor.base.vtable = &humidity_sensor_vtable;
-    sensor.id = id;
-    sensor.humidity = 0.0f;
-    sensor.base.vtable->init(&sensor);
-    return (Sensor *)&sensor;
+    HumiditySensor *sensor = (HumiditySensor *)mem;
+    sensor->base.vtable = &humidity_sensor_vtable;
+    sensor->id = id;
+    sensor->humidity = 0.0f;
+    sensor->base.vtable->init(sensor);
 }
 
-Actuator *create_motion_actuator(int id)
+void construct_motion_actuator(void *mem, int id)
 {
-    static MotorActuator actuator;
-    actuator.base.vtable = &motor_vtable;
-    actuator.id = id;
-    actuator.is_running = 0;
-    actuator.speed = 0;
-    return (Actuator *)&actuator;
+    MotorActuator *actuator = (MotorActuator *)mem;
+    actuator->base.vtable = &motor_vtable;
+    actuator->id = id;
+    actuator->is_running = 0;
+    actuator->speed = 0;
 }
 
-// 全局工厂实例
-const DeviceFactory EnvironmentFactory = {
-    .create_sensor = create_environment_sensor,
-    .create_actuator = create_environment_actuator};
+// 全局产品族实例
+const DeviceFamily EnvironmentFamily = {
+    .sensor_size = sizeof(TemperatureSensor),
+    .actuator_size = sizeof(LedActuator),
+    .construct_sensor = construct_environment_sensor,
+    .construct_actuator = construct_environment_actuator};
+
+const DeviceFamily MotionFamily = {
+    .sensor_size = sizeof(HumiditySensor),
+    .actuator_size = sizeof(MotorActuator),
+    .construct_sensor = construct_motion_sensor,
+    .construct_actuator = construct_motion_actuator};
 
-const DeviceFactory MotionFactory = {
-    .create_sensor = create_motion_sensor,
-    .create_actuator = create_motion_actuator};
+// 批量创建：n 个传感器只做一次 arena 分配，按 ids 顺序连续排布。
+// 返回第一个设备，第 i 个用 sensor_at() 取；arena 空间不足返回 NULL。
+// 工厂带注册表时同时按 id 登记，id 已存在或批内重复则整批失败（不占用 arena）。
+Sensor *create_sensors(const DeviceFactory *factory, const int *ids, size_t n)
+{
+    size_t stride = factory->family->sensor_size;
+    if (n == 0 || n > SIZE_MAX / stride)
+        return NULL;
+    if (factory->registry && !device_registry_prepare(factory->registry, DEVICE_KIND_SENSOR, ids, n))
+        return NULL;
+    unsigned char *block = (unsigned char *)device_arena_alloc(factory->arena, stride * n);
+    if (!block)
+        return NULL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        factory->family->construct_sensor(block + i * stride, ids[i]);
+        if (factory->registry)
+            device_registry_add(factory->registry, DEVICE_KIND_SENSOR, ids[i], block + i * stride);
+    }
+    return (Sensor *)block;
+}
+
+Actuator *create_actuators(const DeviceFactory *factory, const int *ids, size_t n)
+{
+    size_t stride = factory->family->actuator_size;
+    if (n == 0 || n > SIZE_MAX / stride)
+        return NULL;
+    if (factory->registry && !device_registry_prepare(factory->registry, DEVICE_KIND_ACTUATOR, ids, n))
+        return NULL;
+    unsigned char *block = (unsigned char *)device_arena_alloc(factory->arena, stride * n);
+    if (!block)
+        return NULL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        factory->family->construct_actuator(block + i * stride, ids[i]);
+        if (factory->registry)
+            device_registry_add(factory->registry, DEVICE_KIND_ACTUATOR, ids[i], block + i * stride);
+    }
+    return (Actuator *)block;
+}
+
+Sensor *create_sensor(const DeviceFactory *factory, int id)
+{
+    return create_sensors(factory, &id, 1);
+}
+
+Actuator *create_actuator(const DeviceFactory *factory, int id)
+{
+    return create_actuators(factory, &id, 1);
+}
+
+// 批量创建结果中的第 i 个设备
+Sensor *sensor_at(const DeviceFactory *factory, Sensor *first, size_t i)
+{
+    return (Sensor *)((unsigned char *)first + i * factory->family->sensor_size);
+}
+
+Actuator *actuator_at(const DeviceFactory *factory, Actuator *first, size_t i)
+{
+    return (Actuator *)((unsigned char *)first + i * factory->family->actuator_size);
+}
+
+// ==================== 执行器批量命令 ====================
+
+// 控制循环每个 tick 可能要改几百个 LED/电机。命令先放进批次里：
+// 同一设备只保留最后一条（重复写入只留最后一次），提交时若目标状态与
+// 设备当前状态相同则跳过（activate 后又 deactivate 就相互抵消）。
+// commit 按设备类型（vtable）分组、组内保持提交顺序，一趟应用完。
+// 批次存储在 init 时一次分配，之后每个 tick begin/submit/commit 复用，不再分配。
+
+typedef enum
+{
+    ACTUATOR_CMD_DEACTIVATE = 0,
+    ACTUATOR_CMD_ACTIVATE = 1
+} ActuatorCommandKind;
+
+typedef struct
+{
+    Actuator *actuator;
+    uint32_t seq;  // 首次提交的顺序，用于同类型内稳定排序
+    uint32_t slot; // 在哈希表中的位置，commit 时用来清表
+    ActuatorCommandKind kind;
+} ActuatorCommand;
+
+typedef struct
+{
+    ActuatorCommand *cmds;
+    uint32_t *index; // 开放寻址：actuator 指针 -> cmds 下标 + 1，0 为空
+    size_t capacity;
+    size_t index_mask;
+    size_t count;
+} ActuatorBatch;
+
+bool actuator_batch_init(ActuatorBatch *batch, size_t capacity)
+{
+    if (capacity == 0 || capacity >= UINT32_MAX / 2)
+        return false;
+    size_t slots = 1;
+    while (slots < capacity * 2)
+        slots <<= 1;
+    batch->cmds = (ActuatorCommand *)malloc(capacity * sizeof(ActuatorCommand));
+    batch->index = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    if (!batch->cmds || !batch->index)
+    {
+        free(batch->cmds);
+        free(batch->index);
+        batch->cmds = NULL;
+        batch->index = NULL;
+        batch->capacity = 0;
+        return false;
+    }
+    batch->capacity = capacity;
+    batch->index_mask = slots - 1;
+    batch->count = 0;
+    return true;
+}
+
+void actuator_batch_release(ActuatorBatch *batch)
+{
+    free(batch->cmds);
+    free(batch->index);
+    batch->cmds = NULL;
+    batch->index = NULL;
+    batch->capacity = 0;
+    batch->count = 0;
+}
+
+static size_t actuator_batch_hash(const ActuatorBatch *batch, const Actuator *actuator)
+{
+    uint64_t h = (uint64_t)(uintptr_t)actuator * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & batch->index_mask;
+}
+
+// 丢弃未提交的命令，开始新一批
+void actuator_batch_begin(ActuatorBatch *batch)
+{
+    for (size_t i = 0; i < batch->count; ++i)
+        batch->index[batch->cmds[i].slot] = 0;
+    batch->count = 0;
+}
+
+// 记录一条命令；同一设备已有命令时覆盖。批次满时返回 false
+bool actuator_batch_submit(ActuatorBatch *batch, Actuator *actuator, ActuatorCommandKind kind)
+{
+    size_t slot = actuator_batch_hash(batch, actuator);
+    while (batch->index[slot])
+    {
+        ActuatorCommand *cmd = &batch->cmds[batch->index[slot] - 1];
+        if (cmd->actuator == actuator)
+        {
+            cmd->kind = kind; // 只保留最后一次写入
+            return true;
+        }
+        slot = (slot + 1) & batch->index_mask;
+    }
+    if (batch->count == batch->capacity)
+        return false;
+    ActuatorCommand *cmd = &batch->cmds[batch->count];
+    cmd->actuator = actuator;
+    cmd->seq = (uint32_t)batch->count;
+    cmd->slot = (uint32_t)slot;
+    cmd->kind = kind;
+    batch->index[slot] = (uint32_t)++batch->count;
+    return true;
+}
+
+static int actuator_command_order(const void *a, const void *b)
+{
+    const ActuatorCommand *x = (const ActuatorCommand *)a;
+    const ActuatorCommand *y = (const ActuatorCommand *)b;
+    uintptr_t tx = (uintptr_t)x->actuator->vtable, ty = (uintptr_t)y->actuator->vtable;
+    if (tx != ty)
+        return tx < ty ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+// 按设备类型分组一趟应用，跳过不改变状态的命令；返回实际调用的设备数。
+// 提交后批次清空，可直接开始下一批。
+size_t actuator_batch_commit(ActuatorBatch *batch)
+{
+    qsort(batch->cmds, batch->count, sizeof(ActuatorCommand), actuator_command_order);
+    size_t applied = 0;
+    for (size_t i = 0; i < batch->count; ++i)
+    {
+        ActuatorCommand *cmd = &batch->cmds[i];
+        Actuator *a = cmd->actuator;
+        const ActuatorVTable *vt = a->vtable;
+        int want = cmd->kind == ACTUATOR_CMD_ACTIVATE;
+        if ((vt->get_status(a) != 0) == want)
+            continue; // 与当前状态相同：相互抵消或重复
+        if (want)
+            vt->activate(a);
+        else
+            vt->deactivate(a);
+        ++applied;
+    }
+    actuator_batch_begin(batch);
+    return applied;
+}
 
 // ==================== 客户端代码 ====================
 
@@ -231,16 +1079,23 @@ void test_device_system(const DeviceFactory *factory, int sensor_id, int actuato
     printf("\n=== Creating devices from factory ===\n");
 
     // 使用工厂创建产品
-    Sensor *sensor = factory->create_sensor(sensor_id);
-    Actuator *actuator = factory->create_actuator(actuator_id);
+    Sensor *sensor = create_sensor(factory, sensor_id);
+    Actuator *actuator = create_actuator(factory, actuator_id);
+    if (!sensor || !actuator)
+    {
+        printf("Device arena exhausted\n");
+        return;
+    }
 
-    // 使用抽象接口操作产品
+    // 使用抽象接口操作产品（设备日志是异步的，与直接 printf 交错前先 flush）
+    dev_log_flush();
     printf("Testing devices:\n");
     sensor->vtable->read(sensor);
     actuator->vtable->activate(actuator);
+    dev_log_flush();
 
     // 可以安全地向下转型调用具体方法
-    if (factory == &EnvironmentFactory)
+    if (factory->family == &EnvironmentFamily)
     {
         TemperatureSensor *temp_sensor = (TemperatureSensor *)sensor;
         LedActuator *led = (LedActuator *)actuator;
@@ -259,15 +1114,104 @@ void test_device_system(const DeviceFactory *factory, int sensor_id, int actuato
 int main(void)
 {
     printf("=== Embedded Abstract Factory Demo ===\n");
+    dev_log_start();
+    sim_rng_seed(2024, 0); // 固定种子：每次运行的模拟读数相同
+
+    // 所有设备共用一块 arena：启动时一次分配
+    DeviceArena arena;
+    if (!device_arena_init(&arena, 64 * 1024))
+        return 1;
+    // 两个工厂共用一个注册表：任何设备都可按 id 找回
+    DeviceRegistry registry;
+    if (!device_registry_init(&registry, 64))
+        return 1;
+    DeviceFactory environment = {.family = &EnvironmentFamily, .arena = &arena, .registry = &registry};
+    DeviceFactory motion = {.family = &MotionFamily, .arena = &arena, .registry = &registry};
 
     // 使用环境监测工厂
-    test_device_system(&EnvironmentFactory, 101, 201);
+    test_device_system(&environment, 101, 201);
 
     // 使用运动控制工厂
-    test_device_system(&MotionFactory, 102, 202);
+    test_device_system(&motion, 102, 202);
+
+    // 再次使用环境监测工厂创建另一组设备（前一组仍然有效）
+    test_device_system(&environment, 103, 203);
 
-    // 再次使用环境监测工厂创建另一组设备
-    test_device_system(&EnvironmentFactory, 103, 203);
+    // 批量创建：一次分配，设备在内存中连续排布
+    printf("\n=== Bulk provisioning ===\n");
+    int ids[4] = {301, 302, 303, 304};
+    Actuator *leds = create_actuators(&environment, ids, 4);
+    if (leds)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            Actuator *led = actuator_at(&environment, leds, i);
+            led->vtable->activate(led);
+        }
+    }
+    dev_log_flush();
+    printf("Arena used: %zu / %zu bytes\n", arena.used, arena.capacity);
+
+    // 批量命令：一个 tick 的改动先收集，再一次提交
+    printf("\n=== Batched actuator commands ===\n");
+    int motor_ids[2] = {401, 402};
+    Actuator *motors = create_actuators(&motion, motor_ids, 2);
+    ActuatorBatch batch;
+    if (leds && motors && actuator_batch_init(&batch, 64))
+    {
+        actuator_batch_begin(&batch);
+        for (size_t i = 0; i < 4; ++i)
+            actuator_batch_submit(&batch, actuator_at(&environment, leds, i), ACTUATOR_CMD_DEACTIVATE);
+        actuator_batch_submit(&batch, actuator_at(&environment, leds, 0), ACTUATOR_CMD_ACTIVATE); // 覆盖：LED 301 保持开
+        for (size_t i = 0; i < 2; ++i)
+        {
+            actuator_batch_submit(&batch, actuator_at(&motion, motors, i), ACTUATOR_CMD_ACTIVATE);
+            actuator_batch_submit(&batch, actuator_at(&motion, motors, i), ACTUATOR_CMD_ACTIVATE); // 重复写入
+        }
+        actuator_batch_submit(&batch, actuator_at(&motion, motors, 1), ACTUATOR_CMD_DEACTIVATE); // 抵消
+        size_t applied = actuator_batch_commit(&batch);
+        dev_log_flush();
+        printf("Batch applied %zu device updates\n", applied);
+        actuator_batch_release(&batch);
+    }
+
+    // 按 id 查找、按种类遍历
+    printf("\n=== Registry ===\n");
+    DeviceKind kind;
+    Actuator *found = (Actuator *)device_find(&registry, 202, &kind);
+    if (found && kind == DEVICE_KIND_ACTUATOR)
+        found->vtable->deactivate(found);
+    size_t n_sensors;
+    const DeviceEntry *sensors = device_registry_entries(&registry, DEVICE_KIND_SENSOR, &n_sensors);
+    for (size_t i = 0; i < n_sensors; ++i)
+    {
+        Sensor *sensor = (Sensor *)sensors[i].device;
+        sensor->vtable->read(sensor);
+    }
+    dev_log_flush();
+
+    // 批量模拟：一次生成整组读数，写回连续排布的传感器
+    int temp_ids[8] = {501, 502, 503, 504, 505, 506, 507, 508};
+    DeviceFactory quiet = {.family = &EnvironmentFamily, .arena = &arena}; // 不登记
+    Sensor *temps = create_sensors(&quiet, temp_ids, 8);
+    float readings[8];
+    sim_rng_fill_readings(readings, 8, 25.0f, 0.1f, 100);
+    if (temps)
+    {
+        for (size_t i = 0; i < 8; ++i)
+            ((TemperatureSensor *)sensor_at(&quiet, temps, i))->temperature = readings[i];
+    }
+    dev_log_flush();
+    printf("Bulk readings: %.1f %.1f ... %.1f\n", readings[0], readings[1], readings[7]);
+    printf("Duplicate id rejected: %s\n", create_sensor(&environment, 101) ? "no" : "yes");
+    int dup_ids[2] = {7, 7};
+    size_t registered = n_sensors;
+    Sensor *dups = create_sensors(&environment, dup_ids, 2);
+    device_registry_entries(&registry, DEVICE_KIND_SENSOR, &registered);
+    printf("Duplicate ids within a batch rejected: %s\n", !dups && registered == n_sensors ? "yes" : "no");
 
+    device_registry_release(&registry);
+    device_arena_release(&arena);
+    dev_log_stop();
     return 0;
 }
\ No newline at end of file